@@ -0,0 +1,26 @@
+#ifndef CACHE_H
+#define CACHE_H
+
+#include <stdbool.h>
+
+#include "object.h"
+
+#define CACHE_PATH_MAX 4096
+
+// Seconds an image is kept after it was stored, i.e. 30 days.
+#define CACHE_MAX_AGE (30 * 24 * 60 * 60)
+
+// Compiled scripts are cached as images in $XDG_CACHE_HOME/wee, or ~/.cache/wee without it. An
+// image is named by a hash of the source, whether it was optimized and the build of the
+// interpreter, so a changed script or interpreter never finds a stale image. Images that are left
+// behind that way are deleted once they are older than CACHE_MAX_AGE.
+
+// Fills in where the image of `source` is cached. Returns false if there's no cache directory.
+bool cache_path(const char* source, bool optimize, char* path);
+
+// Stores the image of a compiled script at `path`. It is written to a temporary file that is then
+// renamed into place, so other processes only ever see a whole image. Failures are ignored and the
+// script just isn't cached. Old images in the cache are pruned afterwards.
+void cache_store(const char* path, ObjFunction* function);
+
+#endif
@@ -1,15 +1,19 @@
 #ifndef CHUNK_H
 #define CHUNK_H
 
+#include <stdbool.h>
 #include <stdint.h>
 
 #include "value.h"
 #include "value_list.h"
 
+// `is_borrowed` is set when the code points into a mapped image, which is read-only and isn't
+// freed with the chunk.
 typedef struct {
   int len;
   int capacity;
   uint8_t* code;
+  bool is_borrowed;
 
   ValueList consts;
 
@@ -22,6 +26,7 @@ void chunk_init(Chunk* chunk);
 void chunk_free(Chunk* chunk);
 
 void chunk_write(Chunk* chunk, uint8_t byte, uint16_t line);
+void chunk_truncate(Chunk* chunk, int len);
 int chunk_push_const(Chunk* chunk, Value value);
 
 int chunk_get_line(Chunk* chunk, int offset);
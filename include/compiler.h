@@ -13,6 +13,12 @@ typedef struct {
   Token name;
   int depth;
   bool is_captured;
+
+  // Offset of the OP_CLOSURE that initialized a local function, or -1. Unless the function
+  // escapes, i.e. is used other than by calling it directly, its captures are switched to
+  // CAPTURE_STACK once the local goes out of scope.
+  int closure_offset;
+  bool escapes;
 } Local;
 
 typedef enum {
@@ -32,10 +38,27 @@ typedef struct Compiler {
 
   Upvalue upvalues[UINT8_MAX + 1];
 
+  // Offsets of the last variable or property read and of the last forward jump target, or -1.
+  // Code that ends in a read can have it rewritten, e.g. into OP_INVOKE when a call follows,
+  // unless a jump lands after it.
+  int read_offset;
+  int jump_target;
+
+  // Offset of the last OP_INC_LOCAL emitted together with an OP_GET_LOCAL of its result, or -1.
+  int increment_offset;
+
+  // Set once a nested function captures one of this function's upvalues. The upvalue is then
+  // shared by a closure that may outlive the frame it points into, so it can't be CAPTURE_STACK.
+  bool shares_upvalues;
+
+  // Set after a return, until a forward jump lands. Code compiled meanwhile can't be reached.
+  bool terminated;
+
   struct Compiler* parent;
 } Compiler;
 
-ObjFunction* compiler_compile(void);
+// With `optimize` set, the code of every function is run through the optimizer in ir.h.
+ObjFunction* compiler_compile(bool optimize);
 Compiler* compiler_current(void);
 
 #endif
@@ -0,0 +1,16 @@
+#ifndef FLOAT64_H
+#define FLOAT64_H
+
+// Bulk kernels over raw double buffers, vectorized where the target allows it.
+
+double float64_sum(const double* values, int len);
+double float64_dot(const double* a, const double* b, int len);
+double float64_min(const double* values, int len);
+double float64_max(const double* values, int len);
+
+void float64_axpy(double alpha, const double* x, double* y, int len);
+void float64_scale(double* values, double factor, int len);
+void float64_add(const double* a, const double* b, double* dest, int len);
+void float64_mul(const double* a, const double* b, double* dest, int len);
+
+#endif
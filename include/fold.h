@@ -0,0 +1,14 @@
+#ifndef FOLD_H
+#define FOLD_H
+
+#include <stdbool.h>
+
+#include "op.h"
+#include "value.h"
+
+// Apply an operator to constant operands at compile time, giving the same result as the VM.
+// They return false if the VM would raise an error instead, so the operation is left to run time.
+bool fold_unary(OpCode op, Value a, Value* result);
+bool fold_binary(OpCode op, Value a, Value b, Value* result);
+
+#endif
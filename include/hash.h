@@ -0,0 +1,30 @@
+#ifndef HASH_H
+#define HASH_H
+
+#include <stdint.h>
+
+// Streaming hasher; feeding the same bytes in any number of pieces gives the same result.
+typedef struct {
+  uint64_t state;
+  uint64_t tail;
+  int tail_len;
+  int len;
+} Hasher;
+
+void hasher_init(Hasher* hasher);
+void hasher_update(Hasher* hasher, const char* chars, int len);
+uint64_t hasher_finish(Hasher* hasher);
+
+uint32_t hash_string(const char* chars, int len);
+uint32_t hash_u64(uint64_t bits);
+
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wunused-function"
+
+static inline uint32_t hash_fold(uint64_t hash) {
+  return (uint32_t) (hash ^ (hash >> 32));
+}
+
+#pragma clang diagnostic pop
+
+#endif
@@ -0,0 +1,42 @@
+#ifndef IMAGE_H
+#define IMAGE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "object.h"
+
+// A compiled script, stored as a .weec file. After the magic and version, a function is written as
+// its arity, upvalue count, name, accessor field, code, line runs and constants, each nested
+// function in place among the constants. Numbers are little-endian and strings end in a NUL. The
+// upvalues of a closure are described by the operands of its OP_CLOSURE, so they travel with the
+// code.
+#define IMAGE_MAGIC "WEEC"
+#define IMAGE_MAGIC_LEN 4
+
+// Bump whenever the format, the opcodes or their operands change, so old images are rejected.
+#define IMAGE_VERSION 2
+
+// An image file mapped read-only into memory. The code and strings of the functions read from it
+// stay in the mapping, so processes running the same image share those pages.
+typedef struct {
+  const uint8_t* bytes;
+  size_t len;
+} Image;
+
+// Writes the script compiled into `function` along with every function it contains.
+bool image_write(ObjFunction* function, FILE* file);
+
+// Maps the file at `path`, returning false if it can't be mapped or isn't an image.
+bool image_map(const char* path, Image* image);
+
+// Unmapping has to wait until nothing read from the image is left, i.e. after vm_free().
+void image_unmap(Image* image);
+
+// Rebuilds the script written into an image, or returns NULL if it isn't a valid image of this
+// version or any of its functions fails verification.
+ObjFunction* image_read(Image* image);
+
+#endif
@@ -0,0 +1,12 @@
+#ifndef IR_H
+#define IR_H
+
+#include "object.h"
+#include "table.h"
+
+// Rewrites the code of a compiled function through an SSA form built from its bytecode. Code the
+// analysis can't follow is left as it is. Small functions in `functions`, keyed by the global
+// they are declared as, are inlined where they are called through that global.
+void ir_optimize(ObjFunction* function, Table* functions);
+
+#endif
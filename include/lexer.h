@@ -7,14 +7,13 @@
   _(TOKEN_RIGHT_PAREN, ')')   \
   _(TOKEN_LEFT_BRACE, '{')    \
   _(TOKEN_RIGHT_BRACE, '}')   \
+  _(TOKEN_LEFT_BRACKET, '[')  \
+  _(TOKEN_RIGHT_BRACKET, ']') \
   _(TOKEN_COMMA, ',')         \
   _(TOKEN_DOT, '.')           \
   _(TOKEN_COLON, ':')         \
   _(TOKEN_SEMICOLON, ';')     \
-  _(TOKEN_PLUS, '+')          \
-  _(TOKEN_MINUS, '-')         \
-  _(TOKEN_STAR, '*')          \
-  _(TOKEN_SLASH, '/')
+  _(TOKEN_TILDE, '~')
 
 #define KEYWORD_TOKENS(_)   \
   /* Keywords. */           \
@@ -23,6 +22,7 @@
   _(TOKEN_IF, "if")         \
   _(TOKEN_ELSE, "else")     \
   _(TOKEN_FOR, "for")       \
+  _(TOKEN_IN, "in")         \
   _(TOKEN_WHILE, "while")   \
   _(TOKEN_LET, "let")       \
   _(TOKEN_CLASS, "class")   \
@@ -30,25 +30,41 @@
   _(TOKEN_SELF, "self")     \
   _(TOKEN_PRINT, "print")   \
   _(TOKEN_AND, "and")       \
-  _(TOKEN_OR, "or")
+  _(TOKEN_OR, "or")         \
+  _(TOKEN_NIL, "nil")       \
+  _(TOKEN_TRUE, "true")     \
+  _(TOKEN_FALSE, "false")
 
-#define MAYBE_EQ_TOKENS(_)                 \
-  /* Tokens optionally ending with '='. */ \
-  _(TOKEN_BANG, TOKEN_BANG_EQUAL, '!')     \
-  _(TOKEN_EQUAL, TOKEN_EQUAL_EQUAL, '=')   \
-  _(TOKEN_LESSER, TOKEN_LESSER_EQUAL, '<') \
-  _(TOKEN_GREATER, TOKEN_GREATER_EQUAL, '>')
+#define MAYBE_EQ_TOKENS(_)                       \
+  /* Tokens optionally ending with '='. */       \
+  _(TOKEN_BANG, TOKEN_BANG_EQUAL, '!')           \
+  _(TOKEN_EQUAL, TOKEN_EQUAL_EQUAL, '=')         \
+  _(TOKEN_LESSER, TOKEN_LESSER_EQUAL, '<')       \
+  _(TOKEN_GREATER, TOKEN_GREATER_EQUAL, '>')     \
+  _(TOKEN_PLUS, TOKEN_PLUS_EQUAL, '+')           \
+  _(TOKEN_MINUS, TOKEN_MINUS_EQUAL, '-')         \
+  _(TOKEN_STAR, TOKEN_STAR_EQUAL, '*')           \
+  _(TOKEN_SLASH, TOKEN_SLASH_EQUAL, '/')         \
+  _(TOKEN_PERCENT, TOKEN_PERCENT_EQUAL, '%')     \
+  _(TOKEN_AMPERSAND, TOKEN_AMPERSAND_EQUAL, '&') \
+  _(TOKEN_PIPE, TOKEN_PIPE_EQUAL, '|')           \
+  _(TOKEN_CARET, TOKEN_CARET_EQUAL, '^')
 
-#define MISC_TOKENS(_)  \
-  /* Literals. */       \
-  _(TOKEN_IDENTIFIER)   \
-  _(TOKEN_STRING)       \
-  _(TOKEN_NUMBER)       \
-  _(TOKEN_NIL)          \
-  _(TOKEN_TRUE)         \
-  _(TOKEN_FALSE)        \
-  /* Special tokens. */ \
-  _(TOKEN_EOF)          \
+#define MISC_TOKENS(_)     \
+  /* Literals. */          \
+  _(TOKEN_IDENTIFIER)      \
+  _(TOKEN_STRING)          \
+  _(TOKEN_NUMBER)          \
+  /* Shifts. */            \
+  _(TOKEN_LESSER_LESSER)   \
+  _(TOKEN_GREATER_GREATER) \
+  /* Increments. */        \
+  _(TOKEN_PLUS_PLUS)       \
+  _(TOKEN_MINUS_MINUS)     \
+  /* Ranges. */            \
+  _(TOKEN_DOT_DOT)         \
+  /* Special tokens. */    \
+  _(TOKEN_EOF)             \
   _(TOKEN_ERROR)
 
 typedef enum {
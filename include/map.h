@@ -0,0 +1,37 @@
+#ifndef MAP_H
+#define MAP_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "value.h"
+
+typedef struct {
+  Value key;
+  Value value;
+  uint32_t hash;
+  bool is_removed;
+} MapEntry;
+
+// Ordered hash map keyed by any Value. Entries are appended to a dense array in insertion order,
+// and a separate open-addressed index of int32 positions points into it. Removing an entry only
+// flags it; the holes are squeezed out the next time the arrays are rebuilt.
+typedef struct {
+  int len;
+  int entry_len;
+  int entry_capacity;
+  int index_capacity;
+
+  MapEntry* entries;
+  int32_t* index;
+} Map;
+
+void map_init(Map* map);
+void map_free(Map* map);
+
+bool map_set(Map* map, Value key, Value value);
+bool map_get(Map* map, Value key, Value* dest);
+bool map_remove(Map* map, Value key);
+bool map_next(Map* map, int* cursor, Value* key, Value* value);
+
+#endif
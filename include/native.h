@@ -0,0 +1,6 @@
+#ifndef NATIVE_H
+#define NATIVE_H
+
+void natives_define(void);
+
+#endif
@@ -3,22 +3,29 @@
 
 #include <stdbool.h>
 #include <stdint.h>
+#include <string.h>
 
 #include "chunk.h"
+#include "map.h"
 #include "table.h"
 #include "value.h"
+#include "value_list.h"
 
 #define OBJ_KIND(value) (AS_OBJ(value)->kind)
 
 #define AS_STRING(value) ((ObjString*) AS_OBJ(value))
-#define AS_CSTRING(value) (((ObjString*) AS_OBJ(value))->chars)
+#define AS_CSTRING(value) string_chars((ObjString*) AS_OBJ(value))
 #define AS_FUNCTION(value) ((ObjFunction*) AS_OBJ(value))
-#define AS_NATIVE(value) (((ObjNativeFn*) AS_OBJ(value))->function)
+#define AS_NATIVE(value) ((ObjNativeFn*) AS_OBJ(value))
 #define AS_CLOSURE(value) ((ObjClosure*) AS_OBJ(value))
 #define AS_UPVALUE(value) ((ObjUpvalue*) AS_OBJ(value))
 #define AS_CLASS(value) ((ObjClass*) AS_OBJ(value))
 #define AS_INSTANCE(value) ((ObjInstance*) AS_OBJ(value))
 #define AS_BOUND_METHOD(value) ((ObjBoundMethod*) AS_OBJ(value))
+#define AS_LIST(value) ((ObjList*) AS_OBJ(value))
+#define AS_FLOAT64_ARRAY(value) ((ObjFloat64Array*) AS_OBJ(value))
+#define AS_MAP(value) ((ObjMap*) AS_OBJ(value))
+#define AS_SLICE(value) ((ObjSlice*) AS_OBJ(value))
 
 #define IS_STRING(value) obj_is_kind(value, OBJ_STRING)
 #define IS_FUNCTION(value) obj_is_kind(value, OBJ_FUNCTION)
@@ -27,6 +34,13 @@
 #define IS_CLASS(value) obj_is_kind(value, OBJ_CLASS)
 #define IS_INSTANCE(value) obj_is_kind(value, OBJ_INSTANCE)
 #define IS_BOUND_METHOD(value) obj_is_kind(value, OBJ_BOUND_METHOD)
+#define IS_LIST(value) obj_is_kind(value, OBJ_LIST)
+#define IS_FLOAT64_ARRAY(value) obj_is_kind(value, OBJ_FLOAT64_ARRAY)
+#define IS_MAP(value) obj_is_kind(value, OBJ_MAP)
+#define IS_SLICE(value) obj_is_kind(value, OBJ_SLICE)
+
+// Strings and slices both hold text and compare equal by content.
+#define IS_TEXT(value) (IS_STRING(value) || IS_SLICE(value))
 
 typedef enum {
   OBJ_STRING,
@@ -37,6 +51,10 @@ typedef enum {
   OBJ_CLASS,
   OBJ_INSTANCE,
   OBJ_BOUND_METHOD,
+  OBJ_LIST,
+  OBJ_FLOAT64_ARRAY,
+  OBJ_MAP,
+  OBJ_SLICE,
 } ObjKind;
 
 struct Obj {
@@ -45,11 +63,15 @@ struct Obj {
   struct Obj* next;
 };
 
+// The characters follow the string in the same allocation and end in a NUL. A string borrowed from
+// a mapped image holds a pointer to its characters in the image there instead, so read them with
+// string_chars().
 struct ObjString {
   Obj obj;
   int len;
-  const char* chars;
   uint32_t hash;
+  bool is_borrowed;
+  char chars[];
 };
 
 typedef struct {
@@ -57,64 +79,120 @@ typedef struct {
   bool is_local;
 } Upvalue;
 
+// `field` is set for a method that only returns that field of `self`, which a call can then read
+// without pushing a frame. `max_stack` is the deepest the stack of a frame running the function
+// gets, counted from its first slot.
 typedef struct {
   Obj obj;
   int arity;
   Chunk chunk;
   ObjString* name;
   int upvalue_len;
+  ObjString* field;
+  int max_stack;
 } ObjFunction;
 
-typedef Value (*NativeFn)(int arg_len, Value* args);
+// Natives report failures through runtime_error() and return false.
+typedef bool (*NativeFn)(int arg_len, Value* args, Value* result);
 
 typedef struct {
   Obj obj;
+  int arity;
   NativeFn function;
 } ObjNativeFn;
 
-typedef struct ObjUpvalue {
+typedef struct {
   Obj obj;
   Value* ptr;
-  struct ObjUpvalue* next;
   Value closed;
 } ObjUpvalue;
 
+// Only functions that capture variables get a closure; the rest are called as ObjFunction.
+// Captures made with CAPTURE_STACK use upvalues stored after the pointer array, which are not
+// collected objects and stay marked for good.
 typedef struct {
   Obj obj;
   ObjFunction* function;
-  ObjUpvalue** upvalues;
   int upvalue_len;
+  int stack_upvalue_len;
+  ObjUpvalue* upvalues[];
 } ObjClosure;
 
+#define CLOSURE_STACK_UPVALUES(closure)                          \
+  ((ObjUpvalue*) ((closure)->upvalues + (closure)->upvalue_len))
+
+// `initializer` mirrors the "init" entry of `methods` (NULL when there is none) so constructing
+// an instance skips the lookup. `field_len` is the most fields any instance has held so far and
+// presizes the field tables of new instances, up to CLASS_RESERVE_MAX.
+#define CLASS_RESERVE_MAX 64
+
 typedef struct {
   Obj obj;
   ObjString* name;
   Table methods;
+  Obj* initializer;
+  int field_len;
 } ObjClass;
 
+typedef struct ObjBoundMethod ObjBoundMethod;
+
+// `bound` caches the last method bound to this instance, so reading the same method again
+// doesn't allocate.
 typedef struct {
   Obj obj;
   ObjClass* class;
   Table fields;
+  ObjBoundMethod* bound;
 } ObjInstance;
 
-typedef struct {
+struct ObjBoundMethod {
   Obj obj;
   Value receiver;
-  ObjClosure* method;
-} ObjBoundMethod;
+  Obj* method;
+};
+
+typedef struct {
+  Obj obj;
+  ValueList items;
+} ObjList;
+
+// Fixed-length array of unboxed doubles, stored inline after the header.
+typedef struct {
+  Obj obj;
+  int len;
+  double values[];
+} ObjFloat64Array;
+
+typedef struct {
+  Obj obj;
+  Map map;
+} ObjMap;
+
+// View into the characters of a string. Slices are never interned by themselves and keep the
+// whole parent alive.
+typedef struct {
+  Obj obj;
+  ObjString* parent;
+  int start;
+  int len;
+} ObjSlice;
 
 void object_free(Obj* object);
 
 ObjString* string_copy(const char* chars, int len);
-ObjString* string_new(const char* chars, int len);
+ObjString* string_concat(const char* a, int a_len, const char* b, int b_len);
+ObjString* string_borrow(const char* chars, int len);
 ObjFunction* function_new(void);
-ObjNativeFn* native_new(NativeFn function);
-ObjClosure* closure_new(ObjFunction* function);
+ObjNativeFn* native_new(NativeFn function, int arity);
+ObjClosure* closure_new(ObjFunction* function, int stack_upvalue_len);
 ObjUpvalue* upvalue_new(Value* slot);
 ObjClass* class_new(ObjString* name);
 ObjInstance* instance_new(ObjClass* class);
-ObjBoundMethod* boundmethod_new(Value receiver, ObjClosure* method);
+ObjBoundMethod* boundmethod_new(Value receiver, Obj* method);
+ObjList* list_new(void);
+ObjFloat64Array* float64array_new(int len);
+ObjMap* map_new(void);
+ObjSlice* slice_new(ObjString* parent, int start, int len);
 
 #pragma clang diagnostic push
 #pragma clang diagnostic ignored "-Wunused-function"
@@ -123,6 +201,28 @@ static inline bool obj_is_kind(Value value, ObjKind kind) {
   return IS_OBJ(value) && (AS_OBJ(value)->kind == kind);
 }
 
+static inline const char* string_chars(ObjString* string) {
+  if (string->is_borrowed) {
+    const char* chars;
+    memcpy(&chars, string->chars, sizeof(chars));
+    return chars;
+  }
+
+  return string->chars;
+}
+
+static inline const char* text_chars(Value value) {
+  if (IS_STRING(value)) {
+    return string_chars(AS_STRING(value));
+  }
+
+  return string_chars(AS_SLICE(value)->parent) + AS_SLICE(value)->start;
+}
+
+static inline int text_len(Value value) {
+  return IS_STRING(value) ? AS_STRING(value)->len : AS_SLICE(value)->len;
+}
+
 #pragma clang diagnostic pop
 
 #endif
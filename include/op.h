@@ -1,16 +1,28 @@
 #ifndef OP_H
 #define OP_H
 
+#include <stdbool.h>
+#include <stdint.h>
+
 typedef enum {
   OP_RETURN,
   OP_LOAD,
   OP_POP,
+  OP_DUP,
 
   OP_NEGATE,
   OP_ADD,
   OP_SUBTRACT,
   OP_MULTIPLY,
   OP_DIVIDE,
+  OP_MODULO,
+
+  OP_BIT_NOT,
+  OP_BIT_AND,
+  OP_BIT_OR,
+  OP_BIT_XOR,
+  OP_SHIFT_LEFT,
+  OP_SHIFT_RIGHT,
 
   OP_NOT,
   OP_LESSER,
@@ -31,11 +43,60 @@ typedef enum {
   OP_SET_GLOBAL,
   OP_GET_LOCAL,
   OP_SET_LOCAL,
+  OP_INC_LOCAL, // Adds a signed immediate byte to a number in a local, pushing nothing.
 
   OP_JUMP,
   OP_JUMP_BACK,
-  OP_JUMP_IF_TRUE,
-  OP_JUMP_IF_FALSE,
+  OP_JUMP_IF_TRUE_OR_POP,
+  OP_JUMP_IF_FALSE_OR_POP,
+  OP_POP_JUMP_IF_FALSE,
+
+  // Pop both operands and jump unless the comparison holds.
+  OP_JUMP_UNLESS_LESSER,
+  OP_JUMP_UNLESS_GREATER,
+  OP_JUMP_UNLESS_LESSER_EQUAL,
+  OP_JUMP_UNLESS_GREATER_EQUAL,
+  OP_JUMP_UNLESS_EQUAL,
+  OP_JUMP_UNLESS_NOT_EQUAL,
+
+  // Takes a constant and an argument count, and jumps unless the callee below the arguments is
+  // that constant. Guards the code of a function inlined into its caller.
+  OP_JUMP_UNLESS_CALLEE,
+
+  // Variants the optimizer picks where both operands are known to be integers, or doubles, so
+  // they check nothing.
+  OP_ADD_INT,
+  OP_SUBTRACT_INT,
+  OP_MULTIPLY_INT,
+  OP_LESSER_INT,
+  OP_GREATER_INT,
+  OP_LESSER_EQUAL_INT,
+  OP_GREATER_EQUAL_INT,
+  OP_JUMP_UNLESS_LESSER_INT,
+  OP_JUMP_UNLESS_GREATER_INT,
+  OP_JUMP_UNLESS_LESSER_EQUAL_INT,
+  OP_JUMP_UNLESS_GREATER_EQUAL_INT,
+
+  OP_ADD_NUM,
+  OP_SUBTRACT_NUM,
+  OP_MULTIPLY_NUM,
+  OP_LESSER_NUM,
+  OP_GREATER_NUM,
+  OP_LESSER_EQUAL_NUM,
+  OP_GREATER_EQUAL_NUM,
+  OP_JUMP_UNLESS_LESSER_NUM,
+  OP_JUMP_UNLESS_GREATER_NUM,
+  OP_JUMP_UNLESS_LESSER_EQUAL_NUM,
+  OP_JUMP_UNLESS_GREATER_EQUAL_NUM,
+
+  // Fail unless the parameter in a slot is an integer, or a number, which is made a double.
+  OP_CHECK_INT,
+  OP_CHECK_FLOAT,
+
+  // Numeric for loops. Both take the slot of the loop variable, followed by the hidden counter,
+  // limit and step, and a jump offset.
+  OP_FOR_PREP,
+  OP_FOR_LOOP,
 
   OP_CALL,
   OP_CLOSURE,
@@ -51,6 +112,51 @@ typedef enum {
   OP_INHERIT,
   OP_GET_SUPER,
   OP_SUPER_INVOKE,
+
+  OP_LIST,
+  OP_MAP,
+  OP_INDEX_GET,
+  OP_INDEX_SET,
 } OpCode;
 
+// How OP_CLOSURE fills each upvalue; one of these precedes every captured index.
+typedef enum {
+  CAPTURE_UPVALUE, // Share an upvalue of the enclosing closure.
+  CAPTURE_LOCAL,   // Capture a local of the enclosing frame through a heap upvalue.
+  CAPTURE_STACK,   // Same, but the closure never outlives the frame, so point at the slot directly.
+} CaptureKind;
+
+// Operand layout of an instruction.
+typedef enum {
+  SHAPE_NONE,      // No operands.
+  SHAPE_BYTE,      // A constant, slot or count.
+  SHAPE_TWO_BYTES, // A slot and step, or a constant and argument count.
+  SHAPE_JUMP,      // A two-byte jump distance.
+  SHAPE_SLOT_JUMP, // A slot, then a jump distance.
+  SHAPE_GUARD,     // A constant and argument count, then a jump distance.
+  SHAPE_CLOSURE,   // A constant, then a kind and index for each upvalue of that function.
+} OpShape;
+
+OpShape op_shape(uint8_t op);
+
+// Stack effect of an instruction when it doesn't jump, or false for an unknown op.
+bool op_stack_effect(uint8_t op, uint8_t arg, uint8_t arg2, int* pops, int* pushes);
+
+static inline bool shape_jumps(OpShape shape) {
+  return shape == SHAPE_JUMP || shape == SHAPE_SLOT_JUMP || shape == SHAPE_GUARD;
+}
+
+static inline bool op_jumps_back(uint8_t op) {
+  return op == OP_JUMP_BACK || op == OP_FOR_LOOP;
+}
+
+static inline bool op_falls_through(uint8_t op) {
+  return op != OP_JUMP && op != OP_JUMP_BACK && op != OP_RETURN;
+}
+
+// Jumps that leave their operand on the stack when taken.
+static inline bool op_keeps_operand(uint8_t op) {
+  return op == OP_JUMP_IF_TRUE_OR_POP || op == OP_JUMP_IF_FALSE_OR_POP;
+}
+
 #endif
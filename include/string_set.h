@@ -0,0 +1,26 @@
+#ifndef STRING_SET_H
+#define STRING_SET_H
+
+#include <stdint.h>
+
+#include "value.h"
+
+// Weak set of interned strings. Hashes are kept in their own dense array so that probing only
+// touches a key once its hash matches.
+typedef struct {
+  int len;
+  int used;
+  int capacity;
+  uint32_t* hashes;
+  ObjString** keys;
+} StringSet;
+
+void stringset_init(StringSet* set);
+void stringset_free(StringSet* set);
+
+ObjString* stringset_find(StringSet* set, const char* prefix, int prefix_len, const char* suffix,
+                          int suffix_len, uint32_t hash);
+void stringset_add(StringSet* set, ObjString* string);
+void stringset_remove_unmarked(StringSet* set);
+
+#endif
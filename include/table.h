@@ -2,26 +2,42 @@
 #define TABLE_H
 
 #include <stdbool.h>
+#include <stdint.h>
 
 #include "value.h"
 
-typedef struct {
-  ObjString* key;
-  Value value;
-} Entry;
+#define TABLE_GROUP_WIDTH 16
 
+// Swiss table: one control byte per slot holds either a 7-bit tag of the key's hash or one of
+// the empty/deleted markers, and is scanned a group at a time. Keys and values are kept in
+// separate arrays, so a probe only touches them once a tag matches.
+//
+// Large tables resize incrementally: the previous slot arrays (`old_keys`, which heads the same
+// kind of keys/values/control block) stay alive and every operation migrates a group of them
+// until none are left.
 typedef struct {
   int len;
   int capacity;
-  Entry* entries;
+  int growth_left;
+
+  int old_capacity;
+  int migrated;
+
+  ObjString** keys;
+  Value* values;
+  int8_t* ctrl;
+
+  ObjString** old_keys;
 } Table;
 
 void table_init(Table* table);
 void table_free(Table* table);
+void table_reserve(Table* table, int len);
 
 bool table_set(Table* table, ObjString* key, Value value);
 bool table_get(Table* table, ObjString* key, Value* dest);
 bool table_remove(Table* table, ObjString* key);
 void table_add_all(Table* src, Table* dest);
+bool table_next(Table* table, int* cursor, ObjString** key, Value* value);
 
 #endif
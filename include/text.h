@@ -0,0 +1,7 @@
+#ifndef TEXT_H
+#define TEXT_H
+
+// Returns the offset of the first occurrence of `needle` in `haystack`, or -1.
+int text_find(const char* haystack, int haystack_len, const char* needle, int needle_len);
+
+#endif
@@ -2,21 +2,29 @@
 #define VALUE_H
 
 #include <stdbool.h>
+#include <stdint.h>
 
 #define NIL_VAL ((Value){VAL_NIL, {.number = 0}})
 #define BOOL_VAL(value) ((Value){VAL_BOOL, {.boolean = (value)}})
 #define NUMBER_VAL(value) ((Value){VAL_NUMBER, {.number = (value)}})
+#define INT_VAL(value) ((Value){VAL_INT, {.integer = (value)}})
 #define OBJ_VAL(object) ((Value){VAL_OBJ, {.obj = (Obj*) (object)}})
 
 #define AS_BOOL(value) ((value).as.boolean)
 #define AS_NUMBER(value) ((value).as.number)
+#define AS_INT(value) ((value).as.integer)
 #define AS_OBJ(value) ((value).as.obj)
 
 #define IS_NIL(value) ((value).kind == VAL_NIL)
 #define IS_BOOL(value) ((value).kind == VAL_BOOL)
 #define IS_NUMBER(value) ((value).kind == VAL_NUMBER)
+#define IS_INT(value) ((value).kind == VAL_INT)
 #define IS_OBJ(value) ((value).kind == VAL_OBJ)
 
+// Either kind of number; AS_FLOAT widens integers to doubles.
+#define IS_NUMERIC(value) (IS_NUMBER(value) || IS_INT(value))
+#define AS_FLOAT(value) (IS_INT(value) ? (double) AS_INT(value) : AS_NUMBER(value))
+
 typedef struct Obj Obj;
 typedef struct ObjString ObjString;
 
@@ -24,6 +32,7 @@ typedef enum {
   VAL_NIL,
   VAL_BOOL,
   VAL_NUMBER,
+  VAL_INT,
   VAL_OBJ,
 } ValueKind;
 
@@ -32,12 +41,15 @@ typedef struct {
   union {
     bool boolean;
     double number;
+    int64_t integer;
     Obj* obj;
   } as;
 } Value;
 
 bool value_is_falsey(Value value);
 bool value_is_equal(Value a, Value b);
+uint32_t value_hash(Value value);
+bool value_as_int(double number, int64_t* dest);
 
 void value_print(Value value);
 
@@ -0,0 +1,19 @@
+#ifndef VERIFY_H
+#define VERIFY_H
+
+#include "object.h"
+
+// #define VERIFY_CODE
+
+// Follows every path through the code of `function`, which starts with the callee and arguments in
+// its frame, and stores the deepest the stack of the frame gets in `max_stack`. Returns false for
+// code that underflows the stack, joins paths of different depths, jumps anywhere but the start of
+// an instruction or has an operand that doesn't fit its constants, frame or closure. With
+// VERIFY_CODE defined, the reason is reported.
+//
+// Passing doesn't make code from an image safe to run. The kinds of values aren't tracked, so the
+// typed ops the optimizer picks and the loop state OP_FOR_PREP sets up are taken on trust, and only
+// the VM's own checks stand between a forged image and the values it misuses.
+bool verify_function(ObjFunction* function, int* max_stack);
+
+#endif
@@ -5,12 +5,17 @@
 #include <stdlib.h>
 
 #include "object.h"
+#include "string_set.h"
 #include "table.h"
 #include "value.h"
 
 #define FRAMES_MAX 64
 #define STACK_MAX (FRAMES_MAX * 256)
 
+// Values an instruction or native can push for a while on top of the deepest stack of a frame,
+// e.g. a new list kept reachable while it is filled.
+#define STACK_RESERVE 2
+
 // #define TRACE_VM
 
 typedef enum {
@@ -19,10 +24,13 @@ typedef enum {
   INTERPRET_RUNTIME_ERROR,
 } InterpretResult;
 
+// `closure` is NULL when the function captures nothing.
 typedef struct {
+  ObjFunction* function;
   ObjClosure* closure;
   uint8_t* ip;
   Value* slots;
+  int open_upvalue_len;
 } CallFrame;
 
 typedef struct {
@@ -33,8 +41,8 @@ typedef struct {
   Value stack[STACK_MAX];
 
   Obj* objects;
-  ObjUpvalue* open_upvalues;
-  Table strings;
+  ObjUpvalue* open_upvalues[STACK_MAX]; // Indexed like `stack`.
+  StringSet strings;
   ObjString* init_string;
   Table globals;
 
@@ -54,7 +62,8 @@ void vm_free(void);
 void push(Value value);
 Value pop(void);
 
-void define_native(const char* name, NativeFn function);
+void runtime_error(const char* format, ...);
+void define_native(const char* name, int arity, NativeFn function);
 
 InterpretResult vm_interpret(ObjFunction* function);
 
@@ -0,0 +1,144 @@
+#include "cache.h"
+
+#include <dirent.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "hash.h"
+#include "image.h"
+#include "object.h"
+
+// Changes with every build, as the Makefile rebuilds this file whenever another object changes.
+static const char build_id[] = __DATE__ " " __TIME__;
+
+// The directory images are cached in, without the trailing slash. A relative $XDG_CACHE_HOME is
+// ignored, as the spec asks.
+static bool cache_dir(char* dir) {
+  const char* base = getenv("XDG_CACHE_HOME");
+  int len;
+
+  if (base != NULL && base[0] == '/') {
+    len = snprintf(dir, CACHE_PATH_MAX, "%s/wee", base);
+  } else if ((base = getenv("HOME")) != NULL && base[0] != '\0') {
+    len = snprintf(dir, CACHE_PATH_MAX, "%s/.cache/wee", base);
+  } else {
+    return false;
+  }
+
+  return len > 0 && len < CACHE_PATH_MAX;
+}
+
+bool cache_path(const char* source, bool optimize, char* path) {
+  char dir[CACHE_PATH_MAX];
+
+  if (!cache_dir(dir)) {
+    return false;
+  }
+
+  Hasher hasher;
+  char version[] = {IMAGE_VERSION, optimize};
+
+  hasher_init(&hasher);
+  hasher_update(&hasher, build_id, (int) sizeof(build_id));
+  hasher_update(&hasher, version, (int) sizeof(version));
+  hasher_update(&hasher, source, (int) strlen(source));
+
+  int len = snprintf(path, CACHE_PATH_MAX, "%s/%016llx.weec", dir,
+                     (unsigned long long) hasher_finish(&hasher));
+
+  return len > 0 && len < CACHE_PATH_MAX;
+}
+
+// Creates the cache directory along with its parents, e.g. ~/.cache itself.
+static void make_dirs(char* dir) {
+  for (char* slash = strchr(dir + 1, '/'); slash != NULL; slash = strchr(slash + 1, '/')) {
+    *slash = '\0';
+    mkdir(dir, 0700);
+    *slash = '/';
+  }
+
+  mkdir(dir, 0700);
+}
+
+static bool has_suffix(const char* name, const char* suffix) {
+  size_t len = strlen(name);
+  size_t suffix_len = strlen(suffix);
+
+  return len > suffix_len && strcmp(name + len - suffix_len, suffix) == 0;
+}
+
+// Deletes images, and temporary files left behind by a failed store, that are older than
+// CACHE_MAX_AGE.
+static void prune(const char* dir) {
+  DIR* stream = opendir(dir);
+
+  if (stream == NULL) {
+    return;
+  }
+
+  time_t cutoff = time(NULL) - CACHE_MAX_AGE;
+  struct dirent* entry;
+
+  while ((entry = readdir(stream)) != NULL) {
+    const char* name = entry->d_name;
+
+    if (!has_suffix(name, ".weec") && strncmp(name, ".tmp-", 5) != 0) {
+      continue;
+    }
+
+    char path[CACHE_PATH_MAX];
+    struct stat info;
+    int len = snprintf(path, CACHE_PATH_MAX, "%s/%s", dir, name);
+
+    if (len > 0 && len < CACHE_PATH_MAX && lstat(path, &info) == 0 && S_ISREG(info.st_mode) &&
+        info.st_mtime < cutoff) {
+      unlink(path);
+    }
+  }
+
+  closedir(stream);
+}
+
+void cache_store(const char* path, ObjFunction* function) {
+  char dir[CACHE_PATH_MAX];
+  char temp[CACHE_PATH_MAX];
+
+  if (!cache_dir(dir)) {
+    return;
+  }
+
+  make_dirs(dir);
+  int len = snprintf(temp, CACHE_PATH_MAX, "%s/.tmp-XXXXXX", dir);
+
+  if (len <= 0 || len >= CACHE_PATH_MAX) {
+    return;
+  }
+
+  int fd = mkstemp(temp);
+
+  if (fd == -1) {
+    return;
+  }
+
+  FILE* file = fdopen(fd, "wb");
+
+  if (file == NULL) {
+    close(fd);
+    unlink(temp);
+    return;
+  }
+
+  bool is_written = image_write(function, file);
+
+  if (fclose(file) != 0 || !is_written || rename(temp, path) != 0) {
+    unlink(temp);
+  }
+
+  prune(dir);
+}
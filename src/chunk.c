@@ -11,6 +11,7 @@ void chunk_init(Chunk* chunk) {
   chunk->len = 0;
   chunk->capacity = 0;
   chunk->code = NULL;
+  chunk->is_borrowed = false;
 
   chunk->lines_len = 0;
   chunk->lines_capacity = 0;
@@ -20,7 +21,10 @@ void chunk_init(Chunk* chunk) {
 }
 
 void chunk_free(Chunk* chunk) {
-  MEM_FREE_ARRAY(uint8_t, chunk->code, chunk->len);
+  if (!chunk->is_borrowed) {
+    MEM_FREE_ARRAY(uint8_t, chunk->code, chunk->len);
+  }
+
   valuelist_free(&chunk->consts);
   chunk_init(chunk);
 }
@@ -36,7 +40,7 @@ void chunk_write(Chunk* chunk, uint8_t byte, uint16_t line) {
   chunk->code[chunk->len] = byte;
   chunk->len += 1;
 
-  if ((chunk->lines == NULL) || (chunk->lines[chunk->lines_len - 2] != line) ||
+  if ((chunk->lines_len == 0) || (chunk->lines[chunk->lines_len - 2] != line) ||
       (chunk->lines[chunk->lines_len - 1] == UINT16_MAX)) {
     if ((chunk->lines == NULL) || (chunk->lines_capacity < chunk->lines_len + 2)) {
       int old_capacity = chunk->lines_capacity;
@@ -53,6 +57,25 @@ void chunk_write(Chunk* chunk, uint8_t byte, uint16_t line) {
   }
 }
 
+// Drops the code from `len` onwards along with its line info.
+void chunk_truncate(Chunk* chunk, int len) {
+  int drop = chunk->len - len;
+  chunk->len = len;
+
+  while (drop > 0) {
+    uint16_t* run = &chunk->lines[chunk->lines_len - 2];
+    int run_len = run[1] + 1;
+
+    if (run_len > drop) {
+      run[1] -= drop;
+      break;
+    }
+
+    chunk->lines_len -= 2;
+    drop -= run_len;
+  }
+}
+
 int chunk_push_const(Chunk* chunk, Value value) {
   push(value);
   valuelist_write(&chunk->consts, value);
@@ -30,6 +30,24 @@ static int instruction_jump(const char* name, int sign, Chunk* chunk, int offset
   return offset + 3;
 }
 
+static int instruction_increment(const char* name, Chunk* chunk, int offset) {
+  uint8_t slot = chunk->code[offset + 1];
+  int8_t step = (int8_t) chunk->code[offset + 2];
+
+  printf("%-16s %4d %+d\n", name, slot, step);
+
+  return offset + 3;
+}
+
+static int instruction_for(const char* name, int sign, Chunk* chunk, int offset) {
+  uint8_t slot = chunk->code[offset + 1];
+  uint16_t jump = (uint16_t) (chunk->code[offset + 2] << 8) | (uint16_t) chunk->code[offset + 3];
+
+  printf("%-16s %4d %d -> %d\n", name, slot, offset, offset + 4 + sign * jump);
+
+  return offset + 4;
+}
+
 static int instruction_invoke(const char* name, Chunk* chunk, int offset) {
   uint8_t constant = chunk->code[offset + 1];
   uint8_t arg_len = chunk->code[offset + 2];
@@ -41,6 +59,18 @@ static int instruction_invoke(const char* name, Chunk* chunk, int offset) {
   return offset + 3;
 }
 
+static int instruction_guard(const char* name, Chunk* chunk, int offset) {
+  uint8_t constant = chunk->code[offset + 1];
+  uint8_t arg_len = chunk->code[offset + 2];
+  uint16_t jump = (uint16_t) (chunk->code[offset + 3] << 8) | (uint16_t) chunk->code[offset + 4];
+
+  printf("%-16s (%d args) %4d '", name, arg_len, constant);
+  value_print(chunk->consts.values[constant]);
+  printf("' %d -> %d\n", offset, offset + 5 + jump);
+
+  return offset + 5;
+}
+
 #define SIMPLE_INSTR(name) \
   case name:               \
     printf(#name "\n");    \
@@ -76,6 +106,14 @@ int chunk_print_instr(Chunk* chunk, int offset) {
     SIMPLE_INSTR(OP_SUBTRACT);
     SIMPLE_INSTR(OP_MULTIPLY);
     SIMPLE_INSTR(OP_DIVIDE);
+    SIMPLE_INSTR(OP_MODULO);
+
+    SIMPLE_INSTR(OP_BIT_NOT);
+    SIMPLE_INSTR(OP_BIT_AND);
+    SIMPLE_INSTR(OP_BIT_OR);
+    SIMPLE_INSTR(OP_BIT_XOR);
+    SIMPLE_INSTR(OP_SHIFT_LEFT);
+    SIMPLE_INSTR(OP_SHIFT_RIGHT);
 
     SIMPLE_INSTR(OP_NOT);
     SIMPLE_INSTR(OP_LESSER);
@@ -91,11 +129,15 @@ int chunk_print_instr(Chunk* chunk, int offset) {
 
     SIMPLE_INSTR(OP_PRINT);
     SIMPLE_INSTR(OP_POP);
+    SIMPLE_INSTR(OP_DUP);
 
     SIMPLE_INSTR(OP_CLOSE_UPVALUE);
 
     SIMPLE_INSTR(OP_INHERIT);
 
+    SIMPLE_INSTR(OP_INDEX_GET);
+    SIMPLE_INSTR(OP_INDEX_SET);
+
     CONST_INSTR(OP_LOAD);
     CONST_INSTR(OP_DEFINE_GLOBAL);
     CONST_INSTR(OP_GET_GLOBAL);
@@ -114,15 +156,64 @@ int chunk_print_instr(Chunk* chunk, int offset) {
     BYTE_INSTR(OP_SET_UPVALUE);
 
     BYTE_INSTR(OP_CALL);
+    BYTE_INSTR(OP_LIST);
+    BYTE_INSTR(OP_MAP);
 
     JUMP_INSTR(OP_JUMP, 1);
     JUMP_INSTR(OP_JUMP_BACK, -1);
-    JUMP_INSTR(OP_JUMP_IF_TRUE, 1);
-    JUMP_INSTR(OP_JUMP_IF_FALSE, 1);
+    JUMP_INSTR(OP_JUMP_IF_TRUE_OR_POP, 1);
+    JUMP_INSTR(OP_JUMP_IF_FALSE_OR_POP, 1);
+    JUMP_INSTR(OP_POP_JUMP_IF_FALSE, 1);
+
+    JUMP_INSTR(OP_JUMP_UNLESS_LESSER, 1);
+    JUMP_INSTR(OP_JUMP_UNLESS_GREATER, 1);
+    JUMP_INSTR(OP_JUMP_UNLESS_LESSER_EQUAL, 1);
+    JUMP_INSTR(OP_JUMP_UNLESS_GREATER_EQUAL, 1);
+    JUMP_INSTR(OP_JUMP_UNLESS_EQUAL, 1);
+    JUMP_INSTR(OP_JUMP_UNLESS_NOT_EQUAL, 1);
+
+    SIMPLE_INSTR(OP_ADD_INT);
+    SIMPLE_INSTR(OP_SUBTRACT_INT);
+    SIMPLE_INSTR(OP_MULTIPLY_INT);
+    SIMPLE_INSTR(OP_LESSER_INT);
+    SIMPLE_INSTR(OP_GREATER_INT);
+    SIMPLE_INSTR(OP_LESSER_EQUAL_INT);
+    SIMPLE_INSTR(OP_GREATER_EQUAL_INT);
+    JUMP_INSTR(OP_JUMP_UNLESS_LESSER_INT, 1);
+    JUMP_INSTR(OP_JUMP_UNLESS_GREATER_INT, 1);
+    JUMP_INSTR(OP_JUMP_UNLESS_LESSER_EQUAL_INT, 1);
+    JUMP_INSTR(OP_JUMP_UNLESS_GREATER_EQUAL_INT, 1);
+
+    SIMPLE_INSTR(OP_ADD_NUM);
+    SIMPLE_INSTR(OP_SUBTRACT_NUM);
+    SIMPLE_INSTR(OP_MULTIPLY_NUM);
+    SIMPLE_INSTR(OP_LESSER_NUM);
+    SIMPLE_INSTR(OP_GREATER_NUM);
+    SIMPLE_INSTR(OP_LESSER_EQUAL_NUM);
+    SIMPLE_INSTR(OP_GREATER_EQUAL_NUM);
+    JUMP_INSTR(OP_JUMP_UNLESS_LESSER_NUM, 1);
+    JUMP_INSTR(OP_JUMP_UNLESS_GREATER_NUM, 1);
+    JUMP_INSTR(OP_JUMP_UNLESS_LESSER_EQUAL_NUM, 1);
+    JUMP_INSTR(OP_JUMP_UNLESS_GREATER_EQUAL_NUM, 1);
+
+    BYTE_INSTR(OP_CHECK_INT);
+    BYTE_INSTR(OP_CHECK_FLOAT);
 
     INVOKE_INSTR(OP_INVOKE);
     INVOKE_INSTR(OP_SUPER_INVOKE);
 
+    case OP_FOR_PREP:
+      return instruction_for("OP_FOR_PREP", 1, chunk, offset);
+
+    case OP_FOR_LOOP:
+      return instruction_for("OP_FOR_LOOP", -1, chunk, offset);
+
+    case OP_JUMP_UNLESS_CALLEE:
+      return instruction_guard("OP_JUMP_UNLESS_CALLEE", chunk, offset);
+
+    case OP_INC_LOCAL:
+      return instruction_increment("OP_INC_LOCAL", chunk, offset);
+
     case OP_CLOSURE: {
       offset++;
       uint8_t idx = chunk->code[offset++];
@@ -134,11 +225,12 @@ int chunk_print_instr(Chunk* chunk, int offset) {
       ObjFunction* function = AS_FUNCTION(chunk->consts.values[idx]);
 
       for (int i = 0; i < function->upvalue_len; i++) {
-        int is_local = chunk->code[offset++];
+        int kind = chunk->code[offset++];
         int idx = chunk->code[offset++];
 
         printf("%04d      |                     %s %d\n", offset - 2,
-               is_local ? "Local" : "Upvalue", idx);
+               kind == CAPTURE_UPVALUE ? "Upvalue" : (kind == CAPTURE_LOCAL ? "Local" : "Stack"),
+               idx);
       }
 
       return offset;
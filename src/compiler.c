@@ -1,5 +1,6 @@
 #include "compiler.h"
 
+#include <errno.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
@@ -7,10 +8,15 @@
 #include <string.h>
 
 #include "chunk.h"
+#include "fold.h"
+#include "ir.h"
 #include "lexer.h"
+#include "mem.h"
 #include "object.h"
 #include "op.h"
+#include "table.h"
 #include "value.h"
+#include "verify.h"
 
 typedef struct {
   bool had_error;
@@ -18,6 +24,13 @@ typedef struct {
   Token last;
 } Parser;
 
+// Forward jumps waiting to be patched to the same target.
+typedef struct {
+  int* offsets;
+  int len;
+  int capacity;
+} JumpList;
+
 typedef struct ClassCompiler {
   bool has_superclass;
   struct ClassCompiler* parent;
@@ -26,6 +39,10 @@ typedef struct ClassCompiler {
 static Compiler* current;
 static Parser parser;
 static ClassCompiler* current_class = NULL;
+static bool is_optimizing = false;
+
+// Functions declared at the top level so far, by name. The optimizer may inline calls to them.
+static Table global_functions;
 
 static void report_error_at(Token* token, const char* message) {
   if (parser.panic) {
@@ -149,14 +166,19 @@ static void emit_const(Value value) {
   emit_byte((uint8_t) idx);
 }
 
-static int emit_jump(OpCode instruction) {
-  emit_byte(instruction);
+// Emits a placeholder jump offset for patch_jump.
+static int emit_jump_offset(void) {
   emit_byte(0xFF);
   emit_byte(0xFF);
 
   return current_chunk()->len - 2;
 }
 
+static int emit_jump(OpCode instruction) {
+  emit_byte(instruction);
+  return emit_jump_offset();
+}
+
 static void patch_jump(int offset) {
   unsigned int distance = current_chunk()->len - offset - 2;
 
@@ -166,9 +188,43 @@ static void patch_jump(int offset) {
 
   current_chunk()->code[offset] = (distance >> 8) & 0xFF;
   current_chunk()->code[offset + 1] = (distance) & 0xFF;
+
+  current->jump_target = current_chunk()->len;
+  current->terminated = false;
 }
 
+static void jump_list_add(JumpList* list, int offset) {
+  if (list->capacity < list->len + 1) {
+    int old_capacity = list->capacity;
+
+    list->capacity = MEM_GROW_CAPACITY(old_capacity);
+    list->offsets = MEM_GROW_ARRAY(int, list->offsets, old_capacity, list->capacity);
+  }
+
+  list->offsets[list->len++] = offset;
+}
+
+static void jump_list_free(JumpList* list) {
+  MEM_FREE_ARRAY(int, list->offsets, list->capacity);
+  list->offsets = NULL;
+  list->len = 0;
+  list->capacity = 0;
+}
+
+static void jump_list_patch(JumpList* list) {
+  for (int i = 0; i < list->len; i++) {
+    patch_jump(list->offsets[i]);
+  }
+
+  list->len = 0;
+}
+
+// Loops whose body always returns never get back to the start.
 static void emit_jump_back(int start) {
+  if (current->terminated) {
+    return;
+  }
+
   unsigned int distance = current_chunk()->len - start + 3;
 
   if (distance > UINT16_MAX) {
@@ -180,6 +236,155 @@ static void emit_jump_back(int start) {
   emit_byte(distance & 0xFF);
 }
 
+// The op of the read that the code emitted so far ends with, or -1 if there is none that can be
+// rewritten.
+static int trailing_read(void) {
+  Chunk* chunk = current_chunk();
+  int offset = current->read_offset;
+
+  if (offset == -1 || offset != chunk->len - 2 || current->jump_target == chunk->len) {
+    return -1;
+  }
+
+  return chunk->code[offset];
+}
+
+// Adds `step` to a local in place and pushes the result.
+static void emit_increment_local(uint8_t slot, int step) {
+  current->increment_offset = current_chunk()->len;
+
+  emit_byte(OP_INC_LOCAL);
+  emit_byte(slot);
+  emit_byte((uint8_t) (int8_t) step);
+  emit_byte(OP_GET_LOCAL);
+  emit_byte(slot);
+}
+
+// Discards the value on top of the stack. The OP_GET_LOCAL pushing the result of an increment
+// is dropped instead, which leaves the increment as a single instruction.
+static void emit_pop(void) {
+  Chunk* chunk = current_chunk();
+
+  if (current->increment_offset != -1 && current->increment_offset == chunk->len - 5 &&
+      current->jump_target != chunk->len) {
+    chunk_truncate(chunk, chunk->len - 2);
+    current->increment_offset = -1;
+    return;
+  }
+
+  emit_byte(OP_POP);
+}
+
+// Drops the code from `offset` onwards, e.g. because it can never run. Rewrites tracked in the
+// compiler must not reach into the dropped code.
+static void discard_code(int offset) {
+  chunk_truncate(current_chunk(), offset);
+
+  if (current->read_offset >= offset) {
+    current->read_offset = -1;
+  }
+
+  if (current->increment_offset >= offset) {
+    current->increment_offset = -1;
+  }
+
+  if (current->jump_target > offset) {
+    current->jump_target = offset;
+  }
+
+  for (int i = 0; i < current->len; i++) {
+    if (current->locals[i].closure_offset >= offset) {
+      current->locals[i].closure_offset = -1;
+    }
+  }
+}
+
+// The value pushed by the code in [offset, end), if that is a single constant load.
+static bool constant_at(int offset, int end, Value* value) {
+  Chunk* chunk = current_chunk();
+
+  if (end - offset == 2 && chunk->code[offset] == OP_LOAD) {
+    *value = chunk->consts.values[chunk->code[offset + 1]];
+    return true;
+  }
+
+  if (end - offset != 1) {
+    return false;
+  }
+
+  switch (chunk->code[offset]) {
+    case OP_NIL:
+      *value = NIL_VAL;
+      return true;
+
+    case OP_TRUE:
+      *value = BOOL_VAL(true);
+      return true;
+
+    case OP_FALSE:
+      *value = BOOL_VAL(false);
+      return true;
+
+    default:
+      return false;
+  }
+}
+
+// Removes the entry loaded by the constant load at `offset` from the constant table, provided
+// nothing was added after it. The load itself is left to discard_code.
+static void drop_constant(int offset) {
+  Chunk* chunk = current_chunk();
+
+  if (chunk->code[offset] == OP_LOAD && chunk->code[offset + 1] == chunk->consts.len - 1) {
+    chunk->consts.len -= 1;
+  }
+}
+
+static void emit_value(Value value) {
+  if (IS_NIL(value)) {
+    emit_byte(OP_NIL);
+  } else if (IS_BOOL(value)) {
+    emit_byte(AS_BOOL(value) ? OP_TRUE : OP_FALSE);
+  } else {
+    emit_const(value);
+  }
+}
+
+// Emits a unary operator applied to the code from `operand`, folding it if that is a constant.
+static void emit_unary(OpCode op, int operand) {
+  Value a, result;
+
+  if (constant_at(operand, current_chunk()->len, &a) && fold_unary(op, a, &result)) {
+    drop_constant(operand);
+    discard_code(operand);
+    emit_value(result);
+  } else {
+    emit_byte(op);
+  }
+}
+
+// Replaces a binary operation on the constants compiled from `left` and `right` with its result.
+static bool fold_binary_at(OpCode op, int left, int right) {
+  Value a, b, result;
+
+  if (!constant_at(left, right, &a) || !constant_at(right, current_chunk()->len, &b) ||
+      !fold_binary(op, a, b, &result)) {
+    return false;
+  }
+
+  drop_constant(right);
+  drop_constant(left);
+  discard_code(left);
+  emit_value(result);
+  return true;
+}
+
+static void emit_binary(OpCode op, int left, int right) {
+  if (!fold_binary_at(op, left, right)) {
+    emit_byte(op);
+  }
+}
+
 // Forward declarations.
 static void expression(void);
 static void statement(void);
@@ -188,6 +393,22 @@ static void scope_begin(void) {
   current->depth += 1;
 }
 
+static void capture_on_stack(Local* local) {
+  if (local->closure_offset == -1 || local->escapes) {
+    return;
+  }
+
+  Chunk* chunk = current_chunk();
+  uint8_t* code = &chunk->code[local->closure_offset];
+  ObjFunction* function = AS_FUNCTION(chunk->consts.values[code[1]]);
+
+  for (int i = 0; i < function->upvalue_len; i++) {
+    if (code[2 + 2 * i] == CAPTURE_LOCAL) {
+      code[2 + 2 * i] = CAPTURE_STACK;
+    }
+  }
+}
+
 static void scope_end(void) {
   current->depth -= 1;
 
@@ -196,10 +417,11 @@ static void scope_end(void) {
       break;
     }
 
-    if (current->locals[current->len - 1].is_captured) {
-      emit_byte(OP_CLOSE_UPVALUE);
-    } else {
-      emit_byte(OP_POP);
+    Local* local = &current->locals[current->len - 1];
+    capture_on_stack(local);
+
+    if (!current->terminated) {
+      emit_byte(local->is_captured ? OP_CLOSE_UPVALUE : OP_POP);
     }
 
     current->len--;
@@ -217,6 +439,8 @@ static void local_add(Token name) {
   local->name = name;
   local->depth = -1;
   local->is_captured = false;
+  local->closure_offset = -1;
+  local->escapes = false;
 }
 
 static int local_resolve(Compiler* compiler, Token* name) {
@@ -265,12 +489,14 @@ static int upvalue_resolve(Compiler* compiler, Token* name) {
 
     if (local != -1) {
       compiler->parent->locals[local].is_captured = true;
+      compiler->parent->locals[local].escapes = true;
       return upvalue_add(compiler, (uint8_t) local, true);
     }
 
     int upvalue = upvalue_resolve(compiler->parent, name);
 
     if (upvalue != -1) {
+      compiler->parent->shares_upvalues = true;
       return upvalue_add(compiler, (uint8_t) upvalue, false);
     }
   }
@@ -343,6 +569,48 @@ static uint8_t variable(const char* message) {
   return identifier(&parser.last);
 }
 
+static bool compound_op(TokenKind kind, OpCode* op) {
+#define COMPOUND(token, opcode) \
+  case token:                   \
+    *op = opcode;               \
+    return true
+
+  switch (kind) {
+    COMPOUND(TOKEN_PLUS_EQUAL, OP_ADD);
+    COMPOUND(TOKEN_MINUS_EQUAL, OP_SUBTRACT);
+    COMPOUND(TOKEN_STAR_EQUAL, OP_MULTIPLY);
+    COMPOUND(TOKEN_SLASH_EQUAL, OP_DIVIDE);
+    COMPOUND(TOKEN_PERCENT_EQUAL, OP_MODULO);
+    COMPOUND(TOKEN_AMPERSAND_EQUAL, OP_BIT_AND);
+    COMPOUND(TOKEN_PIPE_EQUAL, OP_BIT_OR);
+    COMPOUND(TOKEN_CARET_EQUAL, OP_BIT_XOR);
+
+    default:
+      return false;
+  }
+#undef COMPOUND
+}
+
+// Whether the operand compiled from `start` is a lone integer constant that fits OP_INC_LOCAL,
+// and if so the step that applies it with `op`.
+static bool small_int_operand(int start, OpCode op, int* step) {
+  Chunk* chunk = current_chunk();
+
+  if ((op != OP_ADD && op != OP_SUBTRACT) || chunk->len - start != 2 ||
+      chunk->code[start] != OP_LOAD) {
+    return false;
+  }
+
+  Value value = chunk->consts.values[chunk->code[start + 1]];
+
+  if (!IS_INT(value) || AS_INT(value) < -INT8_MAX || AS_INT(value) > INT8_MAX) {
+    return false;
+  }
+
+  *step = (int) (op == OP_ADD ? AS_INT(value) : -AS_INT(value));
+  return true;
+}
+
 static void expression_variable(Token* name, bool can_assign) {
   int idx = local_resolve(current, name);
   uint8_t set_op = OP_SET_LOCAL;
@@ -360,11 +628,38 @@ static void expression_variable(Token* name, bool can_assign) {
     get_op = OP_GET_GLOBAL;
   }
 
+  OpCode op;
+
   if (can_assign && match(TOKEN_EQUAL)) {
     expression();
     emit_byte(set_op);
     emit_byte((uint8_t) idx);
+  } else if (can_assign && compound_op(peek().kind, &op)) {
+    advance();
+
+    int start = current_chunk()->len;
+    emit_byte(get_op);
+    emit_byte((uint8_t) idx);
+
+    int operand = current_chunk()->len;
+    int step;
+    expression();
+
+    if (get_op == OP_GET_LOCAL && small_int_operand(operand, op, &step)) {
+      chunk_truncate(current_chunk(), start);
+      emit_increment_local((uint8_t) idx, step);
+    } else {
+      emit_byte(op);
+      emit_byte(set_op);
+      emit_byte((uint8_t) idx);
+    }
   } else {
+    if (get_op == OP_GET_LOCAL && peek().kind != TOKEN_LEFT_PAREN) {
+      current->locals[idx].escapes = true;
+    }
+
+    current->read_offset = current_chunk()->len;
+
     emit_byte(get_op);
     emit_byte((uint8_t) idx);
   }
@@ -403,6 +698,68 @@ static void expression_super(void) {
   }
 }
 
+static void expression_list(void) {
+  uint8_t len = 0;
+
+  if (!match(TOKEN_RIGHT_BRACKET)) {
+    do {
+      if (len == UINT8_MAX) {
+        report_error("Can't have more than 255 elements in a list literal.");
+      }
+
+      expression();
+      len++;
+    } while (match(TOKEN_COMMA));
+
+    expect(TOKEN_RIGHT_BRACKET, "Expected ] after list elements.");
+  }
+
+  emit_byte(OP_LIST);
+  emit_byte(len);
+}
+
+// Literals without a fractional part are integers, unless they don't fit one, in which case they
+// are doubles as they always were. A literal is never negative, as the minus is a separate unary
+// op, so INT64_MIN can't be written as one: -9223372036854775808 is a double.
+static void expression_number(Token* token) {
+  if (memchr(token->start, '.', token->len) != NULL) {
+    emit_const(NUMBER_VAL(strtod(token->start, NULL)));
+    return;
+  }
+
+  errno = 0;
+  long long integer = strtoll(token->start, NULL, 10);
+
+  if (errno == ERANGE) {
+    emit_const(NUMBER_VAL(strtod(token->start, NULL)));
+    return;
+  }
+
+  emit_const(INT_VAL(integer));
+}
+
+static void expression_map(void) {
+  uint8_t len = 0;
+
+  if (!match(TOKEN_RIGHT_BRACE)) {
+    do {
+      if (len == UINT8_MAX) {
+        report_error("Can't have more than 255 entries in a map literal.");
+      }
+
+      expression();
+      expect(TOKEN_COLON, "Expected : after map key.");
+      expression();
+      len++;
+    } while (match(TOKEN_COMMA));
+
+    expect(TOKEN_RIGHT_BRACE, "Expected } after map entries.");
+  }
+
+  emit_byte(OP_MAP);
+  emit_byte(len);
+}
+
 static void expression_primary(bool can_assign) {
   Token next = advance();
 
@@ -412,6 +769,14 @@ static void expression_primary(bool can_assign) {
       expect(TOKEN_RIGHT_PAREN, "Expected closing parenthesis.");
       break;
 
+    case TOKEN_LEFT_BRACKET:
+      expression_list();
+      break;
+
+    case TOKEN_LEFT_BRACE:
+      expression_map();
+      break;
+
     case TOKEN_NIL:
       emit_byte(OP_NIL);
       break;
@@ -425,7 +790,7 @@ static void expression_primary(bool can_assign) {
       break;
 
     case TOKEN_NUMBER:
-      emit_const(NUMBER_VAL(strtod(next.start, NULL)));
+      expression_number(&next);
       break;
 
     case TOKEN_STRING:
@@ -456,53 +821,167 @@ static void expression_primary(bool can_assign) {
 }
 
 static void expression_property(bool can_assign) {
-  expression_primary(can_assign);
+  expect(TOKEN_IDENTIFIER, "Expected property name after '.'.");
+  uint8_t name = identifier(&parser.last);
+  OpCode op;
 
-  while (match(TOKEN_DOT)) {
-    expect(TOKEN_IDENTIFIER, "Expected property name after '.'.");
-    uint8_t name = identifier(&parser.last);
+  if (can_assign && match(TOKEN_EQUAL)) {
+    expression();
 
-    if (can_assign && match(TOKEN_EQUAL)) {
-      expression();
+    emit_byte(OP_SET_PROPERTY);
+    emit_byte(name);
+  } else if (can_assign && compound_op(peek().kind, &op)) {
+    advance();
 
-      emit_byte(OP_SET_PROPERTY);
-      emit_byte(name);
-    } else if (match(TOKEN_LEFT_PAREN)) {
-      uint8_t arg_len = argument_list();
+    emit_byte(OP_DUP);
+    emit_byte(OP_GET_PROPERTY);
+    emit_byte(name);
 
-      emit_byte(OP_INVOKE);
-      emit_byte(name);
-      emit_byte(arg_len);
-    } else {
-      emit_byte(OP_GET_PROPERTY);
-      emit_byte(name);
-    }
+    expression();
+
+    emit_byte(op);
+    emit_byte(OP_SET_PROPERTY);
+    emit_byte(name);
+  } else if (match(TOKEN_LEFT_PAREN)) {
+    uint8_t arg_len = argument_list();
+
+    emit_byte(OP_INVOKE);
+    emit_byte(name);
+    emit_byte(arg_len);
+  } else {
+    current->read_offset = current_chunk()->len;
+
+    emit_byte(OP_GET_PROPERTY);
+    emit_byte(name);
   }
 }
 
-static void expression_call(bool can_assign) {
-  expression_property(can_assign);
+static void expression_index(bool can_assign) {
+  expression();
+  expect(TOKEN_RIGHT_BRACKET, "Expected ] after index.");
+
+  if (can_assign && match(TOKEN_EQUAL)) {
+    expression();
+    emit_byte(OP_INDEX_SET);
+  } else {
+    emit_byte(OP_INDEX_GET);
+  }
+}
+
+// Calls whatever the previous expression left on the stack. When that was a property get, as
+// in `(obj.method)(args)`, the pair becomes an OP_INVOKE so no bound method is created.
+static void expression_call_value(void) {
+  if (trailing_read() == OP_GET_PROPERTY) {
+    Chunk* chunk = current_chunk();
+    uint8_t name = chunk->code[current->read_offset + 1];
+    chunk_truncate(chunk, current->read_offset);
 
-  if (match(TOKEN_LEFT_PAREN)) {
     uint8_t arg_len = argument_list();
 
-    emit_byte(OP_CALL);
+    emit_byte(OP_INVOKE);
+    emit_byte(name);
     emit_byte(arg_len);
+    return;
+  }
+
+  uint8_t arg_len = argument_list();
+
+  emit_byte(OP_CALL);
+  emit_byte(arg_len);
+}
+
+static void expression_call(bool can_assign) {
+  expression_primary(can_assign);
+
+  while (true) {
+    if (match(TOKEN_DOT)) {
+      expression_property(can_assign);
+    } else if (match(TOKEN_LEFT_BRACKET)) {
+      expression_index(can_assign);
+    } else if (match(TOKEN_LEFT_PAREN)) {
+      expression_call_value();
+    } else {
+      break;
+    }
   }
 }
 
+// `++target` and `--target` compile the target as a read, then turn that read into an update.
+static void expression_increment(int step) {
+  expression_call(false);
+
+  Chunk* chunk = current_chunk();
+  int read = trailing_read();
+  uint8_t arg = chunk->code[chunk->len - 1];
+  OpCode op = step > 0 ? OP_ADD : OP_SUBTRACT;
+
+  switch (read) {
+    case OP_GET_LOCAL:
+      chunk_truncate(chunk, current->read_offset);
+      emit_increment_local(arg, step);
+      break;
+
+    case OP_GET_UPVALUE:
+    case OP_GET_GLOBAL:
+      emit_const(INT_VAL(1));
+      emit_byte(op);
+      emit_byte(read == OP_GET_UPVALUE ? OP_SET_UPVALUE : OP_SET_GLOBAL);
+      emit_byte(arg);
+      break;
+
+    case OP_GET_PROPERTY:
+      chunk_truncate(chunk, current->read_offset);
+
+      emit_byte(OP_DUP);
+      emit_byte(OP_GET_PROPERTY);
+      emit_byte(arg);
+      emit_const(INT_VAL(1));
+      emit_byte(op);
+      emit_byte(OP_SET_PROPERTY);
+      emit_byte(arg);
+      break;
+
+    default:
+      report_error("Invalid increment target.");
+      return;
+  }
+
+  current->read_offset = -1;
+}
+
 static void expression_unary(bool can_assign) {
   switch (peek().kind) {
-    case TOKEN_MINUS:
+    case TOKEN_MINUS: {
       advance();
+
+      int operand = current_chunk()->len;
       expression_call(false);
-      emit_byte(OP_NEGATE);
+      emit_unary(OP_NEGATE, operand);
       break;
+    }
+
+    case TOKEN_BANG: {
+      advance();
+
+      int operand = current_chunk()->len;
+      expression_call(false);
+      emit_unary(OP_NOT, operand);
+      break;
+    }
 
-    case TOKEN_BANG:
+    case TOKEN_TILDE: {
       advance();
+
+      int operand = current_chunk()->len;
       expression_call(false);
-      emit_byte(OP_NOT);
+      emit_unary(OP_BIT_NOT, operand);
+      break;
+    }
+
+    case TOKEN_PLUS_PLUS:
+    case TOKEN_MINUS_MINUS:
+      advance();
+      expression_increment(parser.last.kind == TOKEN_PLUS_PLUS ? 1 : -1);
       break;
 
     default:
@@ -512,59 +991,147 @@ static void expression_unary(bool can_assign) {
 }
 
 static void expression_factor(bool can_assign) {
+  int left = current_chunk()->len;
   expression_unary(can_assign);
 
-  while (match(TOKEN_STAR) || match(TOKEN_SLASH)) {
-    OpCode op = (parser.last.kind == TOKEN_STAR) ? OP_MULTIPLY : OP_DIVIDE;
+  while (match(TOKEN_STAR) || match(TOKEN_SLASH) || match(TOKEN_PERCENT)) {
+    TokenKind kind = parser.last.kind;
+    OpCode op = kind == TOKEN_STAR ? OP_MULTIPLY : (kind == TOKEN_SLASH ? OP_DIVIDE : OP_MODULO);
+    int right = current_chunk()->len;
     expression_unary(false);
-    emit_byte(op);
+    emit_binary(op, left, right);
   }
 }
 
 static void expression_term(bool can_assign) {
+  int left = current_chunk()->len;
   expression_factor(can_assign);
 
   while (match(TOKEN_PLUS) || match(TOKEN_MINUS)) {
     OpCode op = (parser.last.kind == TOKEN_PLUS) ? OP_ADD : OP_SUBTRACT;
+    int right = current_chunk()->len;
     expression_factor(false);
-    emit_byte(op);
+    emit_binary(op, left, right);
   }
 }
 
-static void expression_comparison(bool can_assign) {
+static void expression_shift(bool can_assign) {
+  int left = current_chunk()->len;
   expression_term(can_assign);
-  OpCode op = 0;
 
-#define SET_OP(token, opcode) \
-  case token:                 \
-    op = opcode;              \
-    break
+  while (match(TOKEN_LESSER_LESSER) || match(TOKEN_GREATER_GREATER)) {
+    OpCode op = (parser.last.kind == TOKEN_LESSER_LESSER) ? OP_SHIFT_LEFT : OP_SHIFT_RIGHT;
+    int right = current_chunk()->len;
+    expression_term(false);
+    emit_binary(op, left, right);
+  }
+}
 
-  switch (peek().kind) {
-    SET_OP(TOKEN_LESSER, OP_LESSER);
-    SET_OP(TOKEN_LESSER_EQUAL, OP_LESSER_EQUAL);
-    SET_OP(TOKEN_GREATER, OP_GREATER);
-    SET_OP(TOKEN_GREATER_EQUAL, OP_GREATER_EQUAL);
-    SET_OP(TOKEN_EQUAL_EQUAL, OP_EQUAL);
-    SET_OP(TOKEN_BANG_EQUAL, OP_NOT_EQUAL);
+// Unlike C, the bitwise operators bind tighter than comparisons, so `a & mask == 0` does what
+// it looks like.
+static void expression_bit_and(bool can_assign) {
+  int left = current_chunk()->len;
+  expression_shift(can_assign);
+
+  while (match(TOKEN_AMPERSAND)) {
+    int right = current_chunk()->len;
+    expression_shift(false);
+    emit_binary(OP_BIT_AND, left, right);
+  }
+}
+
+static void expression_bit_xor(bool can_assign) {
+  int left = current_chunk()->len;
+  expression_bit_and(can_assign);
+
+  while (match(TOKEN_CARET)) {
+    int right = current_chunk()->len;
+    expression_bit_and(false);
+    emit_binary(OP_BIT_XOR, left, right);
+  }
+}
+
+static void expression_bit_or(bool can_assign) {
+  int left = current_chunk()->len;
+  expression_bit_xor(can_assign);
+
+  while (match(TOKEN_PIPE)) {
+    int right = current_chunk()->len;
+    expression_bit_xor(false);
+    emit_binary(OP_BIT_OR, left, right);
+  }
+}
+
+// Maps a comparison token to its value-producing op and to the jump taken when it fails.
+static bool comparison_op(TokenKind kind, OpCode* value_op, OpCode* jump_op) {
+#define COMPARISON(token, value, jump) \
+  case token:                          \
+    *value_op = value;                 \
+    *jump_op = jump;                   \
+    return true
+
+  switch (kind) {
+    COMPARISON(TOKEN_LESSER, OP_LESSER, OP_JUMP_UNLESS_LESSER);
+    COMPARISON(TOKEN_LESSER_EQUAL, OP_LESSER_EQUAL, OP_JUMP_UNLESS_LESSER_EQUAL);
+    COMPARISON(TOKEN_GREATER, OP_GREATER, OP_JUMP_UNLESS_GREATER);
+    COMPARISON(TOKEN_GREATER_EQUAL, OP_GREATER_EQUAL, OP_JUMP_UNLESS_GREATER_EQUAL);
+    COMPARISON(TOKEN_EQUAL_EQUAL, OP_EQUAL, OP_JUMP_UNLESS_EQUAL);
+    COMPARISON(TOKEN_BANG_EQUAL, OP_NOT_EQUAL, OP_JUMP_UNLESS_NOT_EQUAL);
 
     default:
-      return;
+      return false;
+  }
+#undef COMPARISON
+}
+
+static void expression_comparison(bool can_assign) {
+  int left = current_chunk()->len;
+  expression_bit_or(can_assign);
+  OpCode op, jump_op;
+
+  if (!comparison_op(peek().kind, &op, &jump_op)) {
+    return;
   }
-#undef SET_OP
 
   advance();
-  expression_term(false);
-  emit_byte(op);
+
+  int right = current_chunk()->len;
+  expression_bit_or(false);
+  emit_binary(op, left, right);
+}
+
+// A constant left operand decides the result on the spot: either it is kept and the right
+// operand is never evaluated, or it is dropped in favour of the right operand.
+static bool fold_logical(int left, bool keep_if_truthy, void (*operand)(bool)) {
+  Value value;
+
+  if (!constant_at(left, current_chunk()->len, &value)) {
+    return false;
+  }
+
+  if (value_is_falsey(value) != keep_if_truthy) {
+    int right = current_chunk()->len;
+    operand(false);
+    discard_code(right);
+  } else {
+    drop_constant(left);
+    discard_code(left);
+    operand(false);
+  }
+
+  return true;
 }
 
 static void expression_and(bool can_assign) {
+  int left = current_chunk()->len;
   expression_comparison(can_assign);
 
   while (match(TOKEN_AND)) {
-    int end_offset = emit_jump(OP_JUMP_IF_FALSE);
+    if (fold_logical(left, false, expression_comparison)) {
+      continue;
+    }
 
-    emit_byte(OP_POP);
+    int end_offset = emit_jump(OP_JUMP_IF_FALSE_OR_POP);
     expression_comparison(false);
 
     patch_jump(end_offset);
@@ -572,12 +1139,15 @@ static void expression_and(bool can_assign) {
 }
 
 static void expression_or(bool can_assign) {
+  int left = current_chunk()->len;
   expression_and(can_assign);
 
   while (match(TOKEN_OR)) {
-    int end_offset = emit_jump(OP_JUMP_IF_TRUE);
+    if (fold_logical(left, true, expression_and)) {
+      continue;
+    }
 
-    emit_byte(OP_POP);
+    int end_offset = emit_jump(OP_JUMP_IF_TRUE_OR_POP);
     expression_and(false);
 
     patch_jump(end_offset);
@@ -588,11 +1158,101 @@ static void expression(void) {
   expression_or(true);
 }
 
+// Conditions of `if`, `while` and `for` are compiled for their jumps alone, so comparisons branch
+// directly and no operand of `and`/`or` stays on the stack. Every jump taken when the condition
+// is false is added to `exits`.
+static void condition_operand(bool can_assign, JumpList* exits) {
+  int left = current_chunk()->len;
+  expression_bit_or(can_assign);
+  OpCode op, jump_op;
+
+  if (comparison_op(peek().kind, &op, &jump_op)) {
+    advance();
+
+    int right = current_chunk()->len;
+    expression_bit_or(false);
+
+    if (!fold_binary_at(op, left, right)) {
+      jump_list_add(exits, emit_jump(jump_op));
+      return;
+    }
+  }
+
+  Value value;
+
+  if (!constant_at(left, current_chunk()->len, &value)) {
+    jump_list_add(exits, emit_jump(OP_POP_JUMP_IF_FALSE));
+    return;
+  }
+
+  // A constant needs no test: a true one is dropped and a false one always exits.
+  drop_constant(left);
+  discard_code(left);
+
+  if (value_is_falsey(value)) {
+    jump_list_add(exits, emit_jump(OP_JUMP));
+  }
+}
+
+static void condition_and(bool can_assign, JumpList* exits) {
+  condition_operand(can_assign, exits);
+
+  while (match(TOKEN_AND)) {
+    condition_operand(false, exits);
+  }
+}
+
+// Whether the condition code from `start` begins with an unconditional jump out.
+static bool always_exits(int start, JumpList* exits) {
+  return exits->len > 0 && exits->offsets[0] == start + 1 &&
+         current_chunk()->code[start] == OP_JUMP;
+}
+
+// Returns false if the condition can never hold. Its code is discarded then, and `exits` left
+// empty, so the caller can drop whatever it guards.
+static bool condition(JumpList* exits) {
+  JumpList taken = {NULL, 0, 0};
+  int start = current_chunk()->len;
+  int alternative = start;
+  condition_and(true, exits);
+
+  // Once an alternative holds, skip the rest; if it fails, try the next one instead of exiting.
+  // An alternative that always fails is left out.
+  while (match(TOKEN_OR)) {
+    if (always_exits(alternative, exits)) {
+      discard_code(alternative);
+      exits->len = 0;
+    } else {
+      jump_list_add(&taken, emit_jump(OP_JUMP));
+      jump_list_patch(exits);
+    }
+
+    alternative = current_chunk()->len;
+    condition_and(false, exits);
+  }
+
+  jump_list_patch(&taken);
+  jump_list_free(&taken);
+
+  if (always_exits(start, exits)) {
+    discard_code(start);
+    exits->len = 0;
+    return false;
+  }
+
+  return true;
+}
+
 static void compiler_init(Compiler* compiler, TargetKind kind) {
   compiler->function = NULL;
   compiler->kind = kind;
   compiler->len = 0;
   compiler->depth = 0;
+  compiler->read_offset = -1;
+  compiler->jump_target = -1;
+  compiler->increment_offset = -1;
+  compiler->terminated = false;
+  compiler->shares_upvalues = false;
   compiler->parent = current;
 
   compiler->function = function_new();
@@ -607,6 +1267,8 @@ static void compiler_init(Compiler* compiler, TargetKind kind) {
 
   local->depth = 0;
   local->is_captured = false;
+  local->closure_offset = -1;
+  local->escapes = false;
   local->name.start = is_method ? "self" : "";
   local->name.len = is_method ? 4 : 0;
 }
@@ -614,24 +1276,67 @@ static void compiler_init(Compiler* compiler, TargetKind kind) {
 static ObjFunction* compiler_finish(void) {
   ObjFunction* function = current->function;
 
-  if (current->kind == TARGET_CONSTRUCTOR) {
-    emit_byte(OP_GET_LOCAL);
-    emit_byte(0);
-  } else {
-    emit_byte(OP_NIL);
+  for (int i = 0; i < current->len; i++) {
+    capture_on_stack(&current->locals[i]);
   }
 
-  emit_byte(OP_RETURN);
+  if (!current->terminated) {
+    if (current->kind == TARGET_CONSTRUCTOR) {
+      emit_byte(OP_GET_LOCAL);
+      emit_byte(0);
+    } else {
+      emit_byte(OP_NIL);
+    }
+
+    emit_byte(OP_RETURN);
+  }
+
+  if (is_optimizing && !parser.had_error) {
+    ir_optimize(function, &global_functions);
+  }
+
+  // A method that only returns a field of `self`.
+  Chunk* chunk = &function->chunk;
+
+  if (current->kind == TARGET_METHOD && function->arity == 0 && chunk->len == 5 &&
+      chunk->code[0] == OP_GET_LOCAL && chunk->code[1] == 0 && chunk->code[2] == OP_GET_PROPERTY &&
+      chunk->code[4] == OP_RETURN) {
+    function->field = AS_STRING(chunk->consts.values[chunk->code[3]]);
+  }
+
+  if (!parser.had_error && !verify_function(function, &function->max_stack)) {
+    report_error("Compiled code failed verification.");
+  }
 
 #ifdef DUMP_CODE
-  chunk_print(&function->chunk, function->name == NULL ? "<script>" : function->name->chars);
+  chunk_print(&function->chunk,
+              function->name == NULL ? "<script>" : string_chars(function->name));
 #endif
 
   current = current->parent;
   return function;
 }
 
-static void function(TargetKind kind) {
+// `name: int` checks on entry that the argument is an integer, and `name: float` that it is a
+// number, which is made a double. The optimizer relies on both.
+static void parameter_type(uint8_t slot) {
+  expect(TOKEN_IDENTIFIER, "Expected parameter type after :.");
+
+  if (tokens_equal(parser.last, synthetic_token("int"))) {
+    emit_byte(OP_CHECK_INT);
+  } else if (tokens_equal(parser.last, synthetic_token("float"))) {
+    emit_byte(OP_CHECK_FLOAT);
+  } else {
+    report_error("Parameter type must be int or float.");
+    return;
+  }
+
+  emit_byte(slot);
+}
+
+// Returns the offset of the emitted OP_CLOSURE, or -1 if the function needed no closure or its
+// upvalues have to stay on the heap.
+static int function(TargetKind kind) {
   Compiler compiler;
   compiler_init(&compiler, kind);
   scope_begin();
@@ -648,6 +1353,10 @@ static void function(TargetKind kind) {
 
       uint8_t constant = variable("Expected parameter name.");
       variable_define(constant);
+
+      if (match(TOKEN_COLON)) {
+        parameter_type((uint8_t) current->function->arity);
+      }
     } while (match(TOKEN_COMMA));
 
     expect(TOKEN_RIGHT_PAREN, "Expected ) after parameters.");
@@ -664,13 +1373,24 @@ static void function(TargetKind kind) {
   ObjFunction* function = compiler_finish();
   int idx = chunk_push_const(current_chunk(), OBJ_VAL(function));
 
+  // Without captures there is nothing to close over, so the function is used as is.
+  if (function->upvalue_len == 0) {
+    emit_byte(OP_LOAD);
+    emit_byte((uint8_t) idx);
+    return -1;
+  }
+
+  int offset = current_chunk()->len;
+
   emit_byte(OP_CLOSURE);
   emit_byte((uint8_t) idx);
 
   for (int i = 0; i < function->upvalue_len; i++) {
-    emit_byte(compiler.upvalues[i].is_local ? 1 : 0);
+    emit_byte(compiler.upvalues[i].is_local ? CAPTURE_LOCAL : CAPTURE_UPVALUE);
     emit_byte(compiler.upvalues[i].idx);
   }
+
+  return compiler.shares_upvalues ? -1 : offset;
 }
 
 static void method(void) {
@@ -685,9 +1405,7 @@ static void method(void) {
   emit_byte(name_const);
 }
 
-static void declaration_variable(void) {
-  uint8_t global = variable("Expected variable name.");
-
+static void variable_initialize(uint8_t global) {
   if (match(TOKEN_EQUAL)) {
     expression();
   } else {
@@ -698,13 +1416,27 @@ static void declaration_variable(void) {
   variable_define(global);
 }
 
+static void declaration_variable(void) {
+  variable_initialize(variable("Expected variable name."));
+}
+
 static void declaration_function(void) {
   advance();
 
   uint8_t global = variable("Expected function name.");
-  current->locals[current->len - 1].depth = current->depth;
+  Local* local = &current->locals[current->len - 1];
+  local->depth = current->depth;
+
+  int closure_offset = function(TARGET_FUNCTION);
+  Chunk* chunk = current_chunk();
+
+  if (current->depth > 0) {
+    local->closure_offset = closure_offset;
+  } else if (chunk->len >= 2 && chunk->code[chunk->len - 2] == OP_LOAD) {
+    table_set(&global_functions, AS_STRING(chunk->consts.values[global]),
+              chunk->consts.values[chunk->code[chunk->len - 1]]);
+  }
 
-  function(TARGET_FUNCTION);
   variable_define(global);
 }
 
@@ -763,7 +1495,11 @@ static void declaration_class(void) {
   current_class = current_class->parent;
 }
 
+// Declarations after a return are compiled for their errors, then dropped.
 static void declaration(void) {
+  bool is_dead = current->terminated;
+  int start = current_chunk()->len;
+
   switch (peek().kind) {
     case TOKEN_CLASS:
       declaration_class();
@@ -783,6 +1519,11 @@ static void declaration(void) {
       break;
   }
 
+  if (is_dead) {
+    discard_code(start);
+    current->terminated = true;
+  }
+
   if (parser.panic) {
     recover();
   }
@@ -813,29 +1554,58 @@ static void statement_block(void) {
 static void statement_expression(void) {
   expression();
   expect(TOKEN_SEMICOLON, "Expected ; after value.");
-  emit_byte(OP_POP);
+  emit_pop();
 }
 
 static void statement_if(void) {
   advance();
   expect(TOKEN_LEFT_PAREN, "Expected ( after 'if'.");
-  expression();
-  expect(TOKEN_RIGHT_PAREN, "Expected ) after condition.");
 
-  int then_offset = emit_jump(OP_JUMP_IF_FALSE);
+  JumpList exits = {NULL, 0, 0};
+  bool can_hold = condition(&exits);
+  bool can_fail = !can_hold || exits.len > 0;
 
-  emit_byte(OP_POP);
+  expect(TOKEN_RIGHT_PAREN, "Expected ) after condition.");
+
+  int then_start = current_chunk()->len;
   statement();
 
-  int else_offset = emit_jump(OP_JUMP);
-  patch_jump(then_offset);
+  if (!can_hold) {
+    discard_code(then_start);
+    current->terminated = false;
+  }
 
-  emit_byte(OP_POP);
   if (match(TOKEN_ELSE)) {
+    bool then_terminated = current->terminated;
+    int else_offset = can_hold && can_fail && !then_terminated ? emit_jump(OP_JUMP) : -1;
+    jump_list_patch(&exits);
+
+    int else_start = current_chunk()->len;
     statement();
+
+    if (!can_fail) {
+      discard_code(else_start);
+      current->terminated = then_terminated;
+    }
+
+    if (else_offset != -1) {
+      patch_jump(else_offset);
+    }
+  } else {
+    jump_list_patch(&exits);
   }
 
-  patch_jump(else_offset);
+  jump_list_free(&exits);
+}
+
+// There is no `break`, so a loop whose condition can't fail only ends by returning.
+static void loop_end(bool can_hold, bool can_fail, int start) {
+  if (!can_hold) {
+    discard_code(start);
+    current->terminated = false;
+  } else if (!can_fail) {
+    current->terminated = true;
+  }
 }
 
 static void statement_while(void) {
@@ -843,17 +1613,68 @@ static void statement_while(void) {
 
   advance();
   expect(TOKEN_LEFT_PAREN, "Expected ( after 'while'.");
-  expression();
-  expect(TOKEN_RIGHT_PAREN, "Expected ) after condition.");
 
-  int exit_offset = emit_jump(OP_JUMP_IF_FALSE);
+  JumpList exits = {NULL, 0, 0};
+  bool can_hold = condition(&exits);
+  bool can_fail = exits.len > 0;
 
-  emit_byte(OP_POP);
+  expect(TOKEN_RIGHT_PAREN, "Expected ) after condition.");
   statement();
   emit_jump_back(start);
 
+  jump_list_patch(&exits);
+  jump_list_free(&exits);
+  loop_end(can_hold, can_fail, start);
+}
+
+// `for (let i in start..limit, step)` counts from `start` up to, but not including, `limit`; the
+// step defaults to 1 and may be negative. The loop variable declared by the caller is followed by
+// three hidden locals for the counter, limit and step, which are only touched by OP_FOR_PREP and
+// OP_FOR_LOOP. Assigning to the loop variable doesn't change the iteration.
+static void statement_for_range(void) {
+  uint8_t slot = (uint8_t) (current->len - 1);
+  emit_byte(OP_NIL);
+
+  expression();
+  expect(TOKEN_DOT_DOT, "Expected .. after range start.");
+  expression();
+
+  if (match(TOKEN_COMMA)) {
+    expression();
+  } else {
+    emit_const(INT_VAL(1));
+  }
+
+  expect(TOKEN_RIGHT_PAREN, "Expected ) after range.");
+
+  // "for" is a keyword, so these can't be named in the body.
+  for (int i = 0; i < 3; i++) {
+    local_add(synthetic_token("for"));
+  }
+
+  for (int i = slot; i < current->len; i++) {
+    current->locals[i].depth = current->depth;
+  }
+
+  emit_byte(OP_FOR_PREP);
+  emit_byte(slot);
+  int exit_offset = emit_jump_offset();
+  int body_start = current_chunk()->len;
+
+  statement();
+
+  unsigned int distance = current_chunk()->len - body_start + 4;
+
+  if (distance > UINT16_MAX) {
+    report_error("Too much code to jump over.");
+  }
+
+  emit_byte(OP_FOR_LOOP);
+  emit_byte(slot);
+  emit_byte((distance >> 8) & 0xFF);
+  emit_byte(distance & 0xFF);
+
   patch_jump(exit_offset);
-  emit_byte(OP_POP);
 }
 
 static void statement_for(void) {
@@ -861,32 +1682,39 @@ static void statement_for(void) {
   scope_begin();
   expect(TOKEN_LEFT_PAREN, "Expected ( after 'for'.");
 
-  if (!match(TOKEN_SEMICOLON)) {
-    if (match(TOKEN_LET)) {
-      declaration_variable();
-    } else {
-      statement_expression();
+  if (match(TOKEN_LET)) {
+    uint8_t global = variable("Expected variable name.");
+
+    if (match(TOKEN_IN)) {
+      statement_for_range();
+      scope_end();
+      return;
     }
+
+    variable_initialize(global);
+  } else if (!match(TOKEN_SEMICOLON)) {
+    statement_expression();
   }
 
-  int loop_start = current_chunk()->len;
-  int exit_offset = -1;
+  int condition_start = current_chunk()->len;
+  int loop_start = condition_start;
+  JumpList exits = {NULL, 0, 0};
+  bool can_hold = true;
 
   if (!match(TOKEN_SEMICOLON)) {
-    expression();
+    can_hold = condition(&exits);
     expect(TOKEN_SEMICOLON, "Expected ; after loop condition.");
-
-    exit_offset = emit_jump(OP_JUMP_IF_FALSE);
-    emit_byte(OP_POP);
   }
 
+  bool can_fail = exits.len > 0;
+
   if (!match(TOKEN_RIGHT_PAREN)) {
     int body_offset = emit_jump(OP_JUMP);
     int increment_start = current_chunk()->len;
 
     expression();
 
-    emit_byte(OP_POP);
+    emit_pop();
     emit_jump_back(loop_start);
     loop_start = increment_start;
     patch_jump(body_offset);
@@ -897,11 +1725,9 @@ static void statement_for(void) {
   statement();
   emit_jump_back(loop_start);
 
-  if (exit_offset != -1) {
-    patch_jump(exit_offset);
-    emit_byte(OP_POP);
-  }
-
+  jump_list_patch(&exits);
+  jump_list_free(&exits);
+  loop_end(can_hold, can_fail, condition_start);
   scope_end();
 }
 
@@ -922,6 +1748,7 @@ static void statement_return(void) {
   }
 
   emit_byte(OP_RETURN);
+  current->terminated = true;
 }
 
 static void statement(void) {
@@ -956,9 +1783,11 @@ static void statement(void) {
   }
 }
 
-ObjFunction* compiler_compile(void) {
+ObjFunction* compiler_compile(bool optimize) {
   parser.had_error = false;
   parser.panic = false;
+  is_optimizing = optimize;
+  table_init(&global_functions);
 
   Compiler compiler;
   compiler_init(&compiler, TARGET_SCRIPT);
@@ -968,6 +1797,8 @@ ObjFunction* compiler_compile(void) {
   }
 
   ObjFunction* function = compiler_finish();
+  table_free(&global_functions);
+
   return parser.had_error ? NULL : function;
 }
 
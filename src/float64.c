@@ -0,0 +1,213 @@
+#include "float64.h"
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// Each kernel runs a vector loop over as many whole lanes as fit and finishes the remainder with
+// the scalar loop, which is also the whole implementation on targets without SSE2.
+
+#if defined(__AVX__)
+#define LANES 4
+#define VEC __m256d
+#define VEC_LOAD _mm256_loadu_pd
+#define VEC_STORE _mm256_storeu_pd
+#define VEC_SET1 _mm256_set1_pd
+#define VEC_ADD _mm256_add_pd
+#define VEC_MUL _mm256_mul_pd
+#define VEC_MIN _mm256_min_pd
+#define VEC_MAX _mm256_max_pd
+#elif defined(__SSE2__)
+#define LANES 2
+#define VEC __m128d
+#define VEC_LOAD _mm_loadu_pd
+#define VEC_STORE _mm_storeu_pd
+#define VEC_SET1 _mm_set1_pd
+#define VEC_ADD _mm_add_pd
+#define VEC_MUL _mm_mul_pd
+#define VEC_MIN _mm_min_pd
+#define VEC_MAX _mm_max_pd
+#endif
+
+#ifdef LANES
+static inline double vec_reduce(VEC vec, double (*combine)(double, double)) {
+  double lanes[LANES];
+  VEC_STORE(lanes, vec);
+
+  double result = lanes[0];
+
+  for (int i = 1; i < LANES; i++) {
+    result = combine(result, lanes[i]);
+  }
+
+  return result;
+}
+#endif
+
+static inline double scalar_add(double a, double b) {
+  return a + b;
+}
+
+static inline double scalar_min(double a, double b) {
+  return b < a ? b : a;
+}
+
+static inline double scalar_max(double a, double b) {
+  return b > a ? b : a;
+}
+
+double float64_sum(const double* values, int len) {
+  double sum = 0;
+  int i = 0;
+
+#ifdef LANES
+  // Two accumulators hide the latency of the vector add.
+  VEC acc0 = VEC_SET1(0);
+  VEC acc1 = VEC_SET1(0);
+
+  for (; i + 2 * LANES <= len; i += 2 * LANES) {
+    acc0 = VEC_ADD(acc0, VEC_LOAD(values + i));
+    acc1 = VEC_ADD(acc1, VEC_LOAD(values + i + LANES));
+  }
+
+  sum = vec_reduce(VEC_ADD(acc0, acc1), scalar_add);
+#endif
+
+  for (; i < len; i++) {
+    sum += values[i];
+  }
+
+  return sum;
+}
+
+double float64_dot(const double* a, const double* b, int len) {
+  double sum = 0;
+  int i = 0;
+
+#ifdef LANES
+  VEC acc0 = VEC_SET1(0);
+  VEC acc1 = VEC_SET1(0);
+
+  for (; i + 2 * LANES <= len; i += 2 * LANES) {
+    acc0 = VEC_ADD(acc0, VEC_MUL(VEC_LOAD(a + i), VEC_LOAD(b + i)));
+    acc1 = VEC_ADD(acc1, VEC_MUL(VEC_LOAD(a + i + LANES), VEC_LOAD(b + i + LANES)));
+  }
+
+  sum = vec_reduce(VEC_ADD(acc0, acc1), scalar_add);
+#endif
+
+  for (; i < len; i++) {
+    sum += a[i] * b[i];
+  }
+
+  return sum;
+}
+
+// Both expect at least one element.
+double float64_min(const double* values, int len) {
+  double min = values[0];
+  int i = 0;
+
+#ifdef LANES
+  if (len >= LANES) {
+    VEC acc = VEC_LOAD(values);
+
+    for (i = LANES; i + LANES <= len; i += LANES) {
+      acc = VEC_MIN(acc, VEC_LOAD(values + i));
+    }
+
+    min = vec_reduce(acc, scalar_min);
+  }
+#endif
+
+  for (; i < len; i++) {
+    min = scalar_min(min, values[i]);
+  }
+
+  return min;
+}
+
+double float64_max(const double* values, int len) {
+  double max = values[0];
+  int i = 0;
+
+#ifdef LANES
+  if (len >= LANES) {
+    VEC acc = VEC_LOAD(values);
+
+    for (i = LANES; i + LANES <= len; i += LANES) {
+      acc = VEC_MAX(acc, VEC_LOAD(values + i));
+    }
+
+    max = vec_reduce(acc, scalar_max);
+  }
+#endif
+
+  for (; i < len; i++) {
+    max = scalar_max(max, values[i]);
+  }
+
+  return max;
+}
+
+void float64_axpy(double alpha, const double* x, double* y, int len) {
+  int i = 0;
+
+#ifdef LANES
+  VEC factor = VEC_SET1(alpha);
+
+  for (; i + LANES <= len; i += LANES) {
+    VEC_STORE(y + i, VEC_ADD(VEC_LOAD(y + i), VEC_MUL(factor, VEC_LOAD(x + i))));
+  }
+#endif
+
+  for (; i < len; i++) {
+    y[i] += alpha * x[i];
+  }
+}
+
+void float64_scale(double* values, double factor, int len) {
+  int i = 0;
+
+#ifdef LANES
+  VEC vec_factor = VEC_SET1(factor);
+
+  for (; i + LANES <= len; i += LANES) {
+    VEC_STORE(values + i, VEC_MUL(VEC_LOAD(values + i), vec_factor));
+  }
+#endif
+
+  for (; i < len; i++) {
+    values[i] *= factor;
+  }
+}
+
+void float64_add(const double* a, const double* b, double* dest, int len) {
+  int i = 0;
+
+#ifdef LANES
+  for (; i + LANES <= len; i += LANES) {
+    VEC_STORE(dest + i, VEC_ADD(VEC_LOAD(a + i), VEC_LOAD(b + i)));
+  }
+#endif
+
+  for (; i < len; i++) {
+    dest[i] = a[i] + b[i];
+  }
+}
+
+void float64_mul(const double* a, const double* b, double* dest, int len) {
+  int i = 0;
+
+#ifdef LANES
+  for (; i + LANES <= len; i += LANES) {
+    VEC_STORE(dest + i, VEC_MUL(VEC_LOAD(a + i), VEC_LOAD(b + i)));
+  }
+#endif
+
+  for (; i < len; i++) {
+    dest[i] = a[i] * b[i];
+  }
+}
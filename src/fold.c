@@ -0,0 +1,213 @@
+#include "fold.h"
+
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "object.h"
+#include "op.h"
+#include "value.h"
+
+bool fold_unary(OpCode op, Value a, Value* result) {
+  switch (op) {
+    case OP_NEGATE:
+      if (IS_INT(a)) {
+        *result = INT_VAL((int64_t) (0 - (uint64_t) AS_INT(a)));
+      } else if (IS_NUMBER(a)) {
+        *result = NUMBER_VAL(-AS_NUMBER(a));
+      } else {
+        return false;
+      }
+      return true;
+
+    case OP_NOT:
+      *result = BOOL_VAL(value_is_falsey(a));
+      return true;
+
+    case OP_BIT_NOT:
+      if (!IS_INT(a)) {
+        return false;
+      }
+
+      *result = INT_VAL(~AS_INT(a));
+      return true;
+
+    default:
+      return false;
+  }
+}
+
+static bool fold_arith(OpCode op, Value a, Value b, Value* result) {
+  if (IS_INT(a) && IS_INT(b)) {
+    uint64_t x = (uint64_t) AS_INT(a);
+    uint64_t y = (uint64_t) AS_INT(b);
+
+    switch (op) {
+      case OP_ADD:
+        *result = INT_VAL((int64_t) (x + y));
+        return true;
+
+      case OP_SUBTRACT:
+        *result = INT_VAL((int64_t) (x - y));
+        return true;
+
+      case OP_MULTIPLY:
+        *result = INT_VAL((int64_t) (x * y));
+        return true;
+
+      default:
+        break;
+    }
+  }
+
+  double x = AS_FLOAT(a);
+  double y = AS_FLOAT(b);
+
+  switch (op) {
+    case OP_ADD:
+      *result = NUMBER_VAL(x + y);
+      return true;
+
+    case OP_SUBTRACT:
+      *result = NUMBER_VAL(x - y);
+      return true;
+
+    case OP_MULTIPLY:
+      *result = NUMBER_VAL(x * y);
+      return true;
+
+    case OP_DIVIDE:
+      *result = NUMBER_VAL(x / y);
+      return true;
+
+    default:
+      return false;
+  }
+}
+
+static bool fold_bitwise(OpCode op, int64_t a, int64_t b, Value* result) {
+  switch (op) {
+    case OP_BIT_AND:
+      *result = INT_VAL(a & b);
+      return true;
+
+    case OP_BIT_OR:
+      *result = INT_VAL(a | b);
+      return true;
+
+    case OP_BIT_XOR:
+      *result = INT_VAL(a ^ b);
+      return true;
+
+    case OP_SHIFT_LEFT:
+      *result = INT_VAL((int64_t) ((uint64_t) a << (b & 63)));
+      return true;
+
+    case OP_SHIFT_RIGHT:
+      *result = INT_VAL(a >> (b & 63));
+      return true;
+
+    default:
+      return false;
+  }
+}
+
+static bool fold_compare(OpCode op, Value a, Value b, Value* result) {
+  bool is_int = IS_INT(a) && IS_INT(b);
+  int order;
+
+  if (is_int) {
+    order = (AS_INT(a) > AS_INT(b)) - (AS_INT(a) < AS_INT(b));
+  } else if (isnan(AS_FLOAT(a)) || isnan(AS_FLOAT(b))) {
+    *result = BOOL_VAL(false);
+    return true;
+  } else {
+    order = (AS_FLOAT(a) > AS_FLOAT(b)) - (AS_FLOAT(a) < AS_FLOAT(b));
+  }
+
+  switch (op) {
+    case OP_LESSER:
+      *result = BOOL_VAL(order < 0);
+      return true;
+
+    case OP_GREATER:
+      *result = BOOL_VAL(order > 0);
+      return true;
+
+    case OP_LESSER_EQUAL:
+      *result = BOOL_VAL(order <= 0);
+      return true;
+
+    case OP_GREATER_EQUAL:
+      *result = BOOL_VAL(order >= 0);
+      return true;
+
+    default:
+      return false;
+  }
+}
+
+bool fold_binary(OpCode op, Value a, Value b, Value* result) {
+  switch (op) {
+    case OP_EQUAL:
+      *result = BOOL_VAL(value_is_equal(a, b));
+      return true;
+
+    case OP_NOT_EQUAL:
+      *result = BOOL_VAL(!value_is_equal(a, b));
+      return true;
+
+    case OP_ADD:
+      if (IS_STRING(a) && IS_STRING(b)) {
+        ObjString* x = AS_STRING(a);
+        ObjString* y = AS_STRING(b);
+
+        *result = OBJ_VAL(string_concat(string_chars(x), x->len, string_chars(y), y->len));
+        return true;
+      }
+      break;
+
+    default:
+      break;
+  }
+
+  if (!IS_NUMERIC(a) || !IS_NUMERIC(b)) {
+    return false;
+  }
+
+  switch (op) {
+    case OP_ADD:
+    case OP_SUBTRACT:
+    case OP_MULTIPLY:
+    case OP_DIVIDE:
+      return fold_arith(op, a, b, result);
+
+    case OP_MODULO:
+      if (IS_INT(a) && IS_INT(b)) {
+        if (AS_INT(b) == 0) {
+          return false;
+        }
+
+        *result = INT_VAL(AS_INT(b) == -1 ? 0 : AS_INT(a) % AS_INT(b));
+      } else {
+        *result = NUMBER_VAL(fmod(AS_FLOAT(a), AS_FLOAT(b)));
+      }
+      return true;
+
+    case OP_BIT_AND:
+    case OP_BIT_OR:
+    case OP_BIT_XOR:
+    case OP_SHIFT_LEFT:
+    case OP_SHIFT_RIGHT:
+      return IS_INT(a) && IS_INT(b) && fold_bitwise(op, AS_INT(a), AS_INT(b), result);
+
+    case OP_LESSER:
+    case OP_GREATER:
+    case OP_LESSER_EQUAL:
+    case OP_GREATER_EQUAL:
+      return fold_compare(op, a, b, result);
+
+    default:
+      return false;
+  }
+}
@@ -0,0 +1,88 @@
+#include "hash.h"
+
+#include <stdint.h>
+
+// Word-at-a-time multiply-fold hash in the style of wyhash.
+
+#define HASH_P0 0xa0761d6478bd642fULL
+#define HASH_P1 0xe7037ed1a0b428dbULL
+#define HASH_P2 0x8ebc6af09c88c6e3ULL
+#define HASH_P3 0x589965cc75374cc3ULL
+
+static inline uint64_t hash_mix(uint64_t a, uint64_t b) {
+  __extension__ typedef unsigned __int128 uint128_t;
+
+  uint128_t product = (uint128_t) a * b;
+  return (uint64_t) product ^ (uint64_t) (product >> 64);
+}
+
+// Compilers turn this into a single load on little-endian targets.
+static inline uint64_t load_le64(const char* chars) {
+  const uint8_t* bytes = (const uint8_t*) chars;
+
+  return (uint64_t) bytes[0] | ((uint64_t) bytes[1] << 8) | ((uint64_t) bytes[2] << 16) |
+         ((uint64_t) bytes[3] << 24) | ((uint64_t) bytes[4] << 32) | ((uint64_t) bytes[5] << 40) |
+         ((uint64_t) bytes[6] << 48) | ((uint64_t) bytes[7] << 56);
+}
+
+static inline void hasher_absorb(Hasher* hasher, uint64_t word) {
+  hasher->state = hash_mix(word ^ HASH_P1, hasher->state ^ HASH_P0);
+}
+
+void hasher_init(Hasher* hasher) {
+  hasher->state = HASH_P2;
+  hasher->tail = 0;
+  hasher->tail_len = 0;
+  hasher->len = 0;
+}
+
+void hasher_update(Hasher* hasher, const char* chars, int len) {
+  hasher->len += len;
+
+  // Top up a partial word left over from the previous piece.
+  while (hasher->tail_len > 0 && len > 0) {
+    hasher->tail |= (uint64_t) (uint8_t) *chars << (8 * hasher->tail_len);
+    hasher->tail_len += 1;
+    chars += 1;
+    len -= 1;
+
+    if (hasher->tail_len == 8) {
+      hasher_absorb(hasher, hasher->tail);
+      hasher->tail = 0;
+      hasher->tail_len = 0;
+    }
+  }
+
+  if (len == 0) {
+    return;
+  }
+
+  while (len >= 8) {
+    hasher_absorb(hasher, load_le64(chars));
+    chars += 8;
+    len -= 8;
+  }
+
+  for (int i = 0; i < len; i++) {
+    hasher->tail |= (uint64_t) (uint8_t) chars[i] << (8 * i);
+  }
+
+  hasher->tail_len = len;
+}
+
+uint64_t hasher_finish(Hasher* hasher) {
+  return hash_mix(hasher->state ^ hasher->tail ^ HASH_P3, (uint64_t) hasher->len ^ HASH_P1);
+}
+
+uint32_t hash_string(const char* chars, int len) {
+  Hasher hasher;
+
+  hasher_init(&hasher);
+  hasher_update(&hasher, chars, len);
+
+  return hash_fold(hasher_finish(&hasher));
+}
+
+uint32_t hash_u64(uint64_t bits) {
+  return hash_fold(hash_mix(bits ^ HASH_P0, HASH_P1));
+}
@@ -0,0 +1,387 @@
+#include "image.h"
+
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "chunk.h"
+#include "mem.h"
+#include "object.h"
+#include "value.h"
+#include "verify.h"
+#include "vm.h"
+
+typedef enum {
+  CONST_NIL,
+  CONST_FALSE,
+  CONST_TRUE,
+  CONST_INT,
+  CONST_NUMBER,
+  CONST_STRING,
+  CONST_FUNCTION,
+} ConstKind;
+
+typedef struct {
+  const uint8_t* bytes;
+  size_t len;
+  size_t pos;
+  bool failed;
+} Reader;
+
+// Writing.
+
+static bool write_bytes(FILE* file, const void* bytes, size_t len) {
+  return fwrite(bytes, 1, len, file) == len;
+}
+
+static bool write_u8(FILE* file, uint8_t value) {
+  return fputc(value, file) != EOF;
+}
+
+static bool write_u32(FILE* file, uint32_t value) {
+  uint8_t bytes[4];
+
+  for (int i = 0; i < 4; i++) {
+    bytes[i] = (uint8_t) (value >> (8 * i));
+  }
+
+  return write_bytes(file, bytes, sizeof(bytes));
+}
+
+static bool write_u64(FILE* file, uint64_t value) {
+  return write_u32(file, (uint32_t) value) && write_u32(file, (uint32_t) (value >> 32));
+}
+
+static bool write_string(FILE* file, ObjString* string) {
+  return write_u32(file, (uint32_t) string->len) &&
+         write_bytes(file, string_chars(string), (size_t) string->len + 1);
+}
+
+// A string that may be missing, as a flag followed by the string.
+static bool write_optional_string(FILE* file, ObjString* string) {
+  if (string == NULL) {
+    return write_u8(file, 0);
+  }
+
+  return write_u8(file, 1) && write_string(file, string);
+}
+
+static bool write_function(FILE* file, ObjFunction* function);
+
+static bool write_const(FILE* file, Value value) {
+  switch (value.kind) {
+    case VAL_NIL:
+      return write_u8(file, CONST_NIL);
+
+    case VAL_BOOL:
+      return write_u8(file, AS_BOOL(value) ? CONST_TRUE : CONST_FALSE);
+
+    case VAL_INT:
+      return write_u8(file, CONST_INT) && write_u64(file, (uint64_t) AS_INT(value));
+
+    case VAL_NUMBER: {
+      uint64_t bits;
+      double number = AS_NUMBER(value);
+      memcpy(&bits, &number, sizeof(bits));
+
+      return write_u8(file, CONST_NUMBER) && write_u64(file, bits);
+    }
+
+    case VAL_OBJ:
+      if (IS_STRING(value)) {
+        return write_u8(file, CONST_STRING) && write_string(file, AS_STRING(value));
+      }
+
+      if (IS_FUNCTION(value)) {
+        return write_u8(file, CONST_FUNCTION) && write_function(file, AS_FUNCTION(value));
+      }
+
+      return false;
+  }
+
+  return false;
+}
+
+static bool write_function(FILE* file, ObjFunction* function) {
+  Chunk* chunk = &function->chunk;
+
+  if (!write_u8(file, (uint8_t) function->arity) ||
+      !write_u32(file, (uint32_t) function->upvalue_len) ||
+      !write_optional_string(file, function->name) ||
+      !write_optional_string(file, function->field)) {
+    return false;
+  }
+
+  if (!write_u32(file, (uint32_t) chunk->len) ||
+      !write_bytes(file, chunk->code, (size_t) chunk->len)) {
+    return false;
+  }
+
+  if (!write_u32(file, (uint32_t) chunk->lines_len)) {
+    return false;
+  }
+
+  for (int i = 0; i < chunk->lines_len; i++) {
+    if (!write_u8(file, (uint8_t) chunk->lines[i]) ||
+        !write_u8(file, (uint8_t) (chunk->lines[i] >> 8))) {
+      return false;
+    }
+  }
+
+  if (!write_u32(file, (uint32_t) chunk->consts.len)) {
+    return false;
+  }
+
+  for (int i = 0; i < chunk->consts.len; i++) {
+    if (!write_const(file, chunk->consts.values[i])) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+bool image_write(ObjFunction* function, FILE* file) {
+  return write_bytes(file, IMAGE_MAGIC, IMAGE_MAGIC_LEN) && write_u8(file, IMAGE_VERSION) &&
+         write_function(file, function);
+}
+
+// Reading. Running past the end sets `failed`, after which every read gives zeros.
+
+static const uint8_t* read_bytes(Reader* reader, size_t len) {
+  if (reader->failed || reader->len - reader->pos < len) {
+    reader->failed = true;
+    return NULL;
+  }
+
+  const uint8_t* bytes = reader->bytes + reader->pos;
+  reader->pos += len;
+
+  return bytes;
+}
+
+static uint8_t read_u8(Reader* reader) {
+  const uint8_t* bytes = read_bytes(reader, 1);
+  return bytes == NULL ? 0 : bytes[0];
+}
+
+static uint32_t read_u32(Reader* reader) {
+  const uint8_t* bytes = read_bytes(reader, 4);
+
+  if (bytes == NULL) {
+    return 0;
+  }
+
+  return (uint32_t) bytes[0] | ((uint32_t) bytes[1] << 8) | ((uint32_t) bytes[2] << 16) |
+         ((uint32_t) bytes[3] << 24);
+}
+
+static uint64_t read_u64(Reader* reader) {
+  uint64_t low = read_u32(reader);
+  return low | ((uint64_t) read_u32(reader) << 32);
+}
+
+// Strings are borrowed from the image, which keeps the NUL that ends them.
+static ObjString* read_string(Reader* reader) {
+  uint32_t len = read_u32(reader);
+
+  if (len >= INT32_MAX) {
+    reader->failed = true;
+    return NULL;
+  }
+
+  const uint8_t* chars = read_bytes(reader, len + 1);
+
+  if (chars == NULL || chars[len] != '\0') {
+    reader->failed = true;
+    return NULL;
+  }
+
+  return string_borrow((const char*) chars, (int) len);
+}
+
+static ObjString* read_optional_string(Reader* reader) {
+  return read_u8(reader) == 0 ? NULL : read_string(reader);
+}
+
+// Room for `len` items of `size` bytes, which must all be in the image.
+static bool read_len(Reader* reader, uint32_t len, size_t size) {
+  if (reader->failed || len > INT32_MAX || (reader->len - reader->pos) / size < len) {
+    reader->failed = true;
+    return false;
+  }
+
+  return true;
+}
+
+static ObjFunction* read_function(Reader* reader);
+
+static Value read_const(Reader* reader) {
+  switch (read_u8(reader)) {
+    case CONST_NIL:
+      return NIL_VAL;
+
+    case CONST_FALSE:
+      return BOOL_VAL(false);
+
+    case CONST_TRUE:
+      return BOOL_VAL(true);
+
+    case CONST_INT:
+      return INT_VAL((int64_t) read_u64(reader));
+
+    case CONST_NUMBER: {
+      uint64_t bits = read_u64(reader);
+      double number;
+      memcpy(&number, &bits, sizeof(number));
+
+      return NUMBER_VAL(number);
+    }
+
+    case CONST_STRING: {
+      ObjString* string = read_string(reader);
+      return string == NULL ? NIL_VAL : OBJ_VAL(string);
+    }
+
+    case CONST_FUNCTION: {
+      ObjFunction* function = read_function(reader);
+      return function == NULL ? NIL_VAL : OBJ_VAL(function);
+    }
+
+    default:
+      reader->failed = true;
+      return NIL_VAL;
+  }
+}
+
+// The function is kept on the stack while it is filled, since every string read can collect.
+static ObjFunction* read_function(Reader* reader) {
+  ObjFunction* function = function_new();
+  Chunk* chunk = &function->chunk;
+  push(OBJ_VAL(function));
+
+  function->arity = read_u8(reader);
+  function->upvalue_len = (int) read_u32(reader);
+  function->name = read_optional_string(reader);
+  function->field = read_optional_string(reader);
+
+  if (function->upvalue_len > UINT8_MAX + 1) {
+    reader->failed = true;
+  }
+
+  uint32_t len = read_u32(reader);
+
+  // The code runs straight from the image. The mapping is read-only, and nothing writes to code
+  // once it is compiled.
+  if (read_len(reader, len, 1) && len > 0) {
+    chunk->code = (uint8_t*) read_bytes(reader, len);
+    chunk->capacity = (int) len;
+    chunk->len = (int) len;
+    chunk->is_borrowed = true;
+  }
+
+  len = read_u32(reader);
+
+  if (read_len(reader, len, 2) && len > 0) {
+    chunk->lines = MEM_ALLOC(uint16_t, len);
+    chunk->lines_capacity = (int) len;
+
+    for (uint32_t i = 0; i < len; i++) {
+      uint8_t low = read_u8(reader);
+      chunk->lines[i] = (uint16_t) (low | (read_u8(reader) << 8));
+    }
+
+    chunk->lines_len = (int) len;
+  }
+
+  len = read_u32(reader);
+
+  if (read_len(reader, len, 1) && len > UINT8_MAX + 1) {
+    reader->failed = true;
+  }
+
+  for (uint32_t i = 0; i < len && !reader->failed; i++) {
+    Value value = read_const(reader);
+
+    if (!reader->failed) {
+      chunk_push_const(chunk, value);
+    }
+  }
+
+  if (chunk->len == 0 || chunk->lines_len % 2 != 0) {
+    reader->failed = true;
+  }
+
+  // Code the verifier can tell is malformed is rejected outright.
+  if (!reader->failed && !verify_function(function, &function->max_stack)) {
+    reader->failed = true;
+  }
+
+  pop();
+  return reader->failed ? NULL : function;
+}
+
+bool image_map(const char* path, Image* image) {
+  int fd = open(path, O_RDONLY);
+
+  if (fd == -1) {
+    return false;
+  }
+
+  struct stat info;
+
+  if (fstat(fd, &info) == -1 || info.st_size <= IMAGE_MAGIC_LEN) {
+    close(fd);
+    return false;
+  }
+
+  void* bytes = mmap(NULL, (size_t) info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+
+  if (bytes == MAP_FAILED) {
+    return false;
+  }
+
+  image->bytes = bytes;
+  image->len = (size_t) info.st_size;
+
+  if (memcmp(image->bytes, IMAGE_MAGIC, IMAGE_MAGIC_LEN) != 0) {
+    image_unmap(image);
+    return false;
+  }
+
+  return true;
+}
+
+void image_unmap(Image* image) {
+  if (image->bytes != NULL) {
+    munmap((void*) image->bytes, image->len);
+  }
+
+  image->bytes = NULL;
+  image->len = 0;
+}
+
+ObjFunction* image_read(Image* image) {
+  Reader reader = {image->bytes, image->len, IMAGE_MAGIC_LEN, false};
+
+  if (read_u8(&reader) != IMAGE_VERSION) {
+    return NULL;
+  }
+
+  // The script takes no arguments and runs without a closure.
+  ObjFunction* function = read_function(&reader);
+
+  if (reader.failed || reader.pos != reader.len || function->arity != 0 ||
+      function->upvalue_len > 0) {
+    return NULL;
+  }
+
+  return function;
+}
@@ -0,0 +1,2152 @@
+#include "ir.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "chunk.h"
+#include "fold.h"
+#include "mem.h"
+#include "object.h"
+#include "op.h"
+#include "table.h"
+#include "value.h"
+
+// The bytecode of a function is split into basic blocks of decoded instructions. Every value an
+// instruction pushes is an SSA value, and the values in the stack slots, locals included, are
+// followed through each block. Where control flow joins and the incoming values differ, a phi is
+// placed in the slot. A read of a local is a copy, so it gives the value the slot already holds.
+//
+// The passes rewrite the instructions in place, keeping the stack the same at every block
+// boundary, and the blocks are lowered back into the chunk once they are done.
+
+// Deepest stack the analysis follows. Functions going deeper are left as they are.
+#define STACK_SLOTS_MAX 512
+
+#define ROUNDS_MAX 8
+#define HOISTS_MAX 32
+
+// Calls inlined into one function, and instructions an inlined call can take in the caller.
+#define INLINES_MAX 16
+#define INLINE_INSTRS_MAX 12
+
+typedef struct {
+  uint8_t op;
+  uint8_t arg;  // Constant, slot or count.
+  uint8_t arg2; // Step of OP_INC_LOCAL or argument count of an invoke.
+  uint16_t line;
+
+  int target;        // Block a jump goes to, or -1.
+  uint8_t* captures; // Kind and index pairs of an OP_CLOSURE.
+
+  int value; // First SSA value defined by the instruction, or -1 before it is reached.
+} Instr;
+
+typedef struct {
+  Instr* instrs;
+  int len;
+  int capacity;
+
+  // Stack depth on entry, or -1 if the block is never reached, the SSA value in each slot on
+  // entry, and the phi merging a slot where predecessors disagree, or -1.
+  int depth;
+  int* entry;
+  int* phis;
+} Block;
+
+// Where an SSA value comes from: an instruction or phi in `block`, or an argument if that is -1.
+typedef struct {
+  int block;
+  bool is_phi;
+  uint8_t op;
+  uint8_t arg;
+} ValueDef;
+
+typedef struct {
+  ObjFunction* function;
+
+  Block* blocks;
+  int len;
+  int capacity;
+
+  ValueDef* values;
+  int value_len;
+  int value_capacity;
+
+  // Slots captured by a closure can change on any call, so every read of them is a new value.
+  bool captured[UINT8_MAX + 1];
+  bool failed;
+} Ir;
+
+// What is known about the code computing a stack slot within the current block.
+typedef enum {
+  TREE_PURE = 1, // Free of side effects, so it can be moved or replaced.
+  TREE_SAFE = 2, // Can't fail either, so it can be dropped.
+} TreeFlag;
+
+// The stack while stepping through a block.
+typedef struct {
+  int values[STACK_SLOTS_MAX];
+  int starts[STACK_SLOTS_MAX]; // First instruction computing the slot in the block, or -1.
+  uint8_t flags[STACK_SLOTS_MAX];
+  int depth;
+} State;
+
+// A value numbered by its op and operands, or by the constant it loads.
+typedef struct {
+  uint8_t op;
+  int a;
+  int b;
+  Value constant;
+  int value;
+} Number;
+
+typedef struct {
+  Number* entries;
+  int len;
+  int capacity;
+} Numbering;
+
+typedef struct {
+  uint64_t bits[(UINT8_MAX + 1) / 64];
+} SlotSet;
+
+static inline bool op_is_constant(uint8_t op) {
+  return op == OP_LOAD || op == OP_NIL || op == OP_TRUE || op == OP_FALSE;
+}
+
+// Ops whose result only depends on their operands.
+static bool op_is_numbered(uint8_t op) {
+  switch (op) {
+    case OP_NEGATE:
+    case OP_ADD:
+    case OP_SUBTRACT:
+    case OP_MULTIPLY:
+    case OP_DIVIDE:
+    case OP_MODULO:
+    case OP_BIT_NOT:
+    case OP_BIT_AND:
+    case OP_BIT_OR:
+    case OP_BIT_XOR:
+    case OP_SHIFT_LEFT:
+    case OP_SHIFT_RIGHT:
+    case OP_NOT:
+    case OP_LESSER:
+    case OP_GREATER:
+    case OP_LESSER_EQUAL:
+    case OP_GREATER_EQUAL:
+    case OP_EQUAL:
+    case OP_NOT_EQUAL:
+    case OP_ADD_INT:
+    case OP_SUBTRACT_INT:
+    case OP_MULTIPLY_INT:
+    case OP_LESSER_INT:
+    case OP_GREATER_INT:
+    case OP_LESSER_EQUAL_INT:
+    case OP_GREATER_EQUAL_INT:
+    case OP_ADD_NUM:
+    case OP_SUBTRACT_NUM:
+    case OP_MULTIPLY_NUM:
+    case OP_LESSER_NUM:
+    case OP_GREATER_NUM:
+    case OP_LESSER_EQUAL_NUM:
+    case OP_GREATER_EQUAL_NUM:
+      return true;
+
+    default:
+      return false;
+  }
+}
+
+static bool op_is_pure(uint8_t op) {
+  return op_is_constant(op) || op_is_numbered(op) || op == OP_GET_LOCAL || op == OP_GET_UPVALUE ||
+         op == OP_GET_GLOBAL || op == OP_DUP;
+}
+
+static bool op_is_safe(uint8_t op) {
+  return op_is_constant(op) || op == OP_GET_LOCAL || op == OP_GET_UPVALUE || op == OP_DUP ||
+         op == OP_NOT || op == OP_EQUAL || op == OP_NOT_EQUAL;
+}
+
+// Stack effect of an instruction when it doesn't jump, or false for an op the IR doesn't know.
+static inline bool stack_effect(Instr* instr, int* pops, int* pushes) {
+  return op_stack_effect(instr->op, instr->arg, instr->arg2, pops, pushes);
+}
+
+static inline bool instr_pushes(Instr* instr) {
+  int pops, pushes;
+  return stack_effect(instr, &pops, &pushes) && pushes == 1;
+}
+
+static inline ObjFunction* closure_function(Ir* ir, Instr* instr) {
+  return AS_FUNCTION(ir->function->chunk.consts.values[instr->arg]);
+}
+
+static int instr_size(Ir* ir, Instr* instr) {
+  switch (op_shape(instr->op)) {
+    case SHAPE_NONE:
+      return 1;
+
+    case SHAPE_BYTE:
+      return 2;
+
+    case SHAPE_TWO_BYTES:
+    case SHAPE_JUMP:
+      return 3;
+
+    case SHAPE_SLOT_JUMP:
+      return 4;
+
+    case SHAPE_GUARD:
+      return 5;
+
+    case SHAPE_CLOSURE:
+      return 2 + 2 * closure_function(ir, instr)->upvalue_len;
+  }
+
+  return 1;
+}
+
+static Value instr_constant(Ir* ir, Instr* instr) {
+  switch (instr->op) {
+    case OP_NIL:
+      return NIL_VAL;
+
+    case OP_TRUE:
+      return BOOL_VAL(true);
+
+    case OP_FALSE:
+      return BOOL_VAL(false);
+
+    default:
+      return ir->function->chunk.consts.values[instr->arg];
+  }
+}
+
+// Unlike value_is_equal, tells integers from doubles and compares doubles bit by bit.
+static bool same_constant(Value a, Value b) {
+  if (a.kind != b.kind) {
+    return false;
+  }
+
+  switch (a.kind) {
+    case VAL_NIL:
+      return true;
+
+    case VAL_BOOL:
+      return AS_BOOL(a) == AS_BOOL(b);
+
+    case VAL_NUMBER:
+      return memcmp(&AS_NUMBER(a), &AS_NUMBER(b), sizeof(double)) == 0;
+
+    case VAL_INT:
+      return AS_INT(a) == AS_INT(b);
+
+    case VAL_OBJ:
+      return AS_OBJ(a) == AS_OBJ(b);
+  }
+
+  return false;
+}
+
+// The entry for `value` in the constant table, added if there is none, or -1 if the table is full.
+static int constant_index(Ir* ir, Value value) {
+  Chunk* chunk = &ir->function->chunk;
+  int idx = 0;
+
+  while (idx < chunk->consts.len && !same_constant(chunk->consts.values[idx], value)) {
+    idx++;
+  }
+
+  if (idx > UINT8_MAX) {
+    return -1;
+  }
+
+  if (idx == chunk->consts.len) {
+    chunk_push_const(chunk, value);
+  }
+
+  return idx;
+}
+
+// An instruction loading `value`, reusing its constant table entry if there is one.
+static bool constant_instr(Ir* ir, Value value, uint16_t line, Instr* instr) {
+  *instr = (Instr){.op = OP_LOAD, .line = line, .target = -1, .captures = NULL, .value = -1};
+
+  if (IS_NIL(value)) {
+    instr->op = OP_NIL;
+  } else if (IS_BOOL(value)) {
+    instr->op = AS_BOOL(value) ? OP_TRUE : OP_FALSE;
+  } else {
+    int idx = constant_index(ir, value);
+
+    if (idx == -1) {
+      return false;
+    }
+
+    instr->arg = (uint8_t) idx;
+  }
+
+  return true;
+}
+
+static void block_init(Block* block) {
+  block->instrs = NULL;
+  block->len = 0;
+  block->capacity = 0;
+
+  block->depth = -1;
+  block->entry = NULL;
+  block->phis = NULL;
+}
+
+static void block_reset(Block* block) {
+  MEM_FREE_ARRAY(int, block->entry, block->depth + 1);
+  MEM_FREE_ARRAY(int, block->phis, block->depth + 1);
+
+  block->depth = -1;
+  block->entry = NULL;
+  block->phis = NULL;
+}
+
+static void block_reserve(Block* block, int len) {
+  if (block->capacity < len) {
+    int old_capacity = block->capacity;
+
+    while (block->capacity < len) {
+      block->capacity = MEM_GROW_CAPACITY(block->capacity);
+    }
+
+    block->instrs = MEM_GROW_ARRAY(Instr, block->instrs, old_capacity, block->capacity);
+  }
+}
+
+static void block_push(Block* block, Instr instr) {
+  block_reserve(block, block->len + 1);
+  block->instrs[block->len++] = instr;
+}
+
+static void instr_free(Ir* ir, Instr* instr) {
+  if (instr->captures != NULL) {
+    MEM_FREE_ARRAY(uint8_t, instr->captures, 2 * closure_function(ir, instr)->upvalue_len);
+  }
+}
+
+// Replaces the instructions in [start, end) with `len` others.
+static void block_splice(Ir* ir, Block* block, int start, int end, Instr* instrs, int len) {
+  for (int i = start; i < end; i++) {
+    instr_free(ir, &block->instrs[i]);
+  }
+
+  block_reserve(block, block->len - (end - start) + len);
+  memmove(&block->instrs[start + len], &block->instrs[end],
+          sizeof(Instr) * (size_t) (block->len - end));
+
+  if (len > 0) {
+    memcpy(&block->instrs[start], instrs, sizeof(Instr) * (size_t) len);
+  }
+
+  block->len += len - (end - start);
+}
+
+static void ir_init(Ir* ir, ObjFunction* function) {
+  ir->function = function;
+
+  ir->blocks = NULL;
+  ir->len = 0;
+  ir->capacity = 0;
+
+  ir->values = NULL;
+  ir->value_len = 0;
+  ir->value_capacity = 0;
+
+  memset(ir->captured, 0, sizeof(ir->captured));
+  ir->failed = false;
+}
+
+static void ir_free(Ir* ir) {
+  for (int b = 0; b < ir->len; b++) {
+    Block* block = &ir->blocks[b];
+
+    for (int i = 0; i < block->len; i++) {
+      instr_free(ir, &block->instrs[i]);
+    }
+
+    block_reset(block);
+    MEM_FREE_ARRAY(Instr, block->instrs, block->capacity);
+  }
+
+  MEM_FREE_ARRAY(Block, ir->blocks, ir->capacity);
+  MEM_FREE_ARRAY(ValueDef, ir->values, ir->value_capacity);
+  ir_init(ir, NULL);
+}
+
+// Inserts an empty block before `idx`, moving the jumps to the blocks after it along.
+static Block* ir_insert_block(Ir* ir, int idx) {
+  if (ir->capacity < ir->len + 1) {
+    int old_capacity = ir->capacity;
+
+    ir->capacity = MEM_GROW_CAPACITY(old_capacity);
+    ir->blocks = MEM_GROW_ARRAY(Block, ir->blocks, old_capacity, ir->capacity);
+  }
+
+  memmove(&ir->blocks[idx + 1], &ir->blocks[idx], sizeof(Block) * (size_t) (ir->len - idx));
+  ir->len += 1;
+  block_init(&ir->blocks[idx]);
+
+  for (int b = 0; b < ir->len; b++) {
+    for (int i = 0; i < ir->blocks[b].len; i++) {
+      Instr* instr = &ir->blocks[b].instrs[i];
+
+      if (instr->target >= idx) {
+        instr->target += 1;
+      }
+    }
+  }
+
+  return &ir->blocks[idx];
+}
+
+static void find_captures(Ir* ir) {
+  memset(ir->captured, 0, sizeof(ir->captured));
+
+  for (int b = 0; b < ir->len; b++) {
+    for (int i = 0; i < ir->blocks[b].len; i++) {
+      Instr* instr = &ir->blocks[b].instrs[i];
+
+      if (instr->op != OP_CLOSURE) {
+        continue;
+      }
+
+      for (int j = 0; j < closure_function(ir, instr)->upvalue_len; j++) {
+        if (instr->captures[2 * j] != CAPTURE_UPVALUE) {
+          ir->captured[instr->captures[2 * j + 1]] = true;
+        }
+      }
+    }
+  }
+}
+
+// Splits the code into blocks, starting a new one at every jump target and after every jump.
+static bool ir_build(Ir* ir) {
+  Chunk* chunk = &ir->function->chunk;
+  int* block_at = MEM_ALLOC(int, chunk->len + 1);
+  bool is_valid = true;
+
+  for (int offset = 0; offset <= chunk->len; offset++) {
+    block_at[offset] = -1;
+  }
+
+  block_at[0] = 0;
+
+  for (int offset = 0; offset < chunk->len && is_valid;) {
+    Instr instr = {.op = chunk->code[offset]};
+
+    if (offset + 1 < chunk->len) {
+      instr.arg = chunk->code[offset + 1];
+    }
+
+    int size = instr_size(ir, &instr);
+    OpShape shape = op_shape(instr.op);
+
+    if (offset + size > chunk->len) {
+      is_valid = false;
+    } else if (shape_jumps(shape)) {
+      int distance = (chunk->code[offset + size - 2] << 8) | chunk->code[offset + size - 1];
+      int target = offset + size + (op_jumps_back(instr.op) ? -distance : distance);
+
+      if (target < 0 || target >= chunk->len) {
+        is_valid = false;
+      } else {
+        block_at[target] = 0;
+        block_at[offset + size] = 0;
+      }
+    } else if (instr.op == OP_RETURN) {
+      block_at[offset + size] = 0;
+    }
+
+    offset += size;
+  }
+
+  for (int offset = 0; offset < chunk->len && is_valid; offset++) {
+    if (block_at[offset] == 0) {
+      block_at[offset] = ir->len;
+      ir_insert_block(ir, ir->len);
+    }
+  }
+
+  int run = 0;
+  int run_end = chunk->lines_len > 0 ? chunk->lines[1] + 1 : 0;
+  Block* block = NULL;
+
+  for (int offset = 0; offset < chunk->len && is_valid;) {
+    if (block_at[offset] != -1) {
+      block = &ir->blocks[block_at[offset]];
+    }
+
+    while (offset >= run_end && run + 2 < chunk->lines_len) {
+      run += 2;
+      run_end += chunk->lines[run + 1] + 1;
+    }
+
+    Instr instr = {
+      .op = chunk->code[offset],
+      .arg = offset + 1 < chunk->len ? chunk->code[offset + 1] : 0,
+      .line = chunk->lines[run],
+      .target = -1,
+      .captures = NULL,
+      .value = -1,
+    };
+
+    int size = instr_size(ir, &instr);
+    OpShape shape = op_shape(instr.op);
+
+    // A jump into the middle of an instruction.
+    for (int i = offset + 1; i < offset + size; i++) {
+      is_valid &= block_at[i] == -1;
+    }
+
+    if (shape == SHAPE_TWO_BYTES || shape == SHAPE_GUARD) {
+      instr.arg2 = chunk->code[offset + 2];
+    }
+
+    if (shape_jumps(shape)) {
+      int distance = (chunk->code[offset + size - 2] << 8) | chunk->code[offset + size - 1];
+      instr.target = block_at[offset + size + (op_jumps_back(instr.op) ? -distance : distance)];
+    } else if (shape == SHAPE_CLOSURE) {
+      instr.captures = MEM_ALLOC(uint8_t, size - 2);
+      memcpy(instr.captures, &chunk->code[offset + 2], (size_t) (size - 2));
+    }
+
+    block_push(block, instr);
+    offset += size;
+  }
+
+  MEM_FREE_ARRAY(int, block_at, chunk->len + 1);
+  find_captures(ir);
+
+  return is_valid && ir->len > 0;
+}
+
+static int value_new(Ir* ir, int block, bool is_phi, uint8_t op, uint8_t arg) {
+  if (ir->value_capacity < ir->value_len + 1) {
+    int old_capacity = ir->value_capacity;
+
+    ir->value_capacity = MEM_GROW_CAPACITY(old_capacity);
+    ir->values = MEM_GROW_ARRAY(ValueDef, ir->values, old_capacity, ir->value_capacity);
+  }
+
+  ir->values[ir->value_len] = (ValueDef){.block = block, .is_phi = is_phi, .op = op, .arg = arg};
+  return ir->value_len++;
+}
+
+static int number(Numbering* numbering, Number key) {
+  for (int i = 0; i < numbering->len; i++) {
+    Number* entry = &numbering->entries[i];
+
+    if (entry->op != key.op) {
+      continue;
+    }
+
+    if (key.op == OP_LOAD ? same_constant(entry->constant, key.constant)
+                          : entry->a == key.a && entry->b == key.b) {
+      return entry->value;
+    }
+  }
+
+  if (numbering->capacity < numbering->len + 1) {
+    int old_capacity = numbering->capacity;
+
+    numbering->capacity = MEM_GROW_CAPACITY(old_capacity);
+    numbering->entries =
+        MEM_GROW_ARRAY(Number, numbering->entries, old_capacity, numbering->capacity);
+  }
+
+  numbering->entries[numbering->len++] = key;
+  return key.value;
+}
+
+static void state_enter(Block* block, State* state) {
+  state->depth = block->depth;
+
+  for (int i = 0; i < block->depth; i++) {
+    state->values[i] = block->entry[i];
+    state->starts[i] = -1;
+    state->flags[i] = 0;
+  }
+}
+
+// Updates the stack for the instruction at `idx` as if it ran without jumping.
+static void step(Ir* ir, int b, int idx, State* state, Numbering* numbering) {
+  Instr* instr = &ir->blocks[b].instrs[idx];
+  int pops, pushes;
+
+  if (!stack_effect(instr, &pops, &pushes) || state->depth < pops ||
+      state->depth - pops + pushes > STACK_SLOTS_MAX) {
+    ir->failed = true;
+    return;
+  }
+
+  if (instr->value == -1) {
+    instr->value = ir->value_len;
+
+    for (int i = op_shape(instr->op) == SHAPE_SLOT_JUMP ? 4 : 1; i > 0; i--) {
+      value_new(ir, b, false, instr->op, instr->arg);
+    }
+  }
+
+  int base = state->depth - pops;
+  int slot = instr->arg;
+  int result = instr->value;
+
+  switch (instr->op) {
+    case OP_GET_LOCAL:
+      if (slot >= state->depth) {
+        ir->failed = true;
+        return;
+      }
+
+      if (!ir->captured[slot]) {
+        result = state->values[slot];
+      }
+      break;
+
+    case OP_DUP:
+      if (state->depth == 0) {
+        ir->failed = true;
+        return;
+      }
+
+      result = state->values[state->depth - 1];
+      break;
+
+    case OP_SET_LOCAL:
+    case OP_INC_LOCAL:
+    case OP_CHECK_INT:
+    case OP_CHECK_FLOAT:
+      if (slot >= state->depth) {
+        ir->failed = true;
+        return;
+      }
+
+      state->values[slot] =
+          instr->op == OP_SET_LOCAL ? state->values[state->depth - 1] : instr->value;
+      break;
+
+    case OP_FOR_PREP:
+    case OP_FOR_LOOP:
+      if (slot + 3 >= state->depth) {
+        ir->failed = true;
+        return;
+      }
+
+      for (int i = 0; i < 4; i++) {
+        state->values[slot + i] = instr->value + i;
+      }
+      break;
+
+    default:
+      if (op_is_constant(instr->op)) {
+        Number key = {.op = OP_LOAD, .constant = instr_constant(ir, instr), .value = result};
+        result = number(numbering, key);
+      } else if (op_is_numbered(instr->op)) {
+        Number key = {
+          .op = instr->op,
+          .a = state->values[base],
+          .b = pops == 2 ? state->values[base + 1] : -1,
+          .value = result,
+        };
+        result = number(numbering, key);
+      }
+      break;
+  }
+
+  if (pushes == 0) {
+    // Whatever computes the slot below now has this instruction in the middle of it.
+    state->depth = base;
+
+    if (base > 0) {
+      state->flags[base - 1] = 0;
+    }
+
+    return;
+  }
+
+  int start = pops == 0 ? idx : state->starts[base];
+  uint8_t flags = (op_is_pure(instr->op) ? TREE_PURE : 0) | (op_is_safe(instr->op) ? TREE_SAFE : 0);
+
+  for (int i = base; i < state->depth; i++) {
+    flags &= state->flags[i];
+  }
+
+  state->values[base] = result;
+  state->starts[base] = start;
+  state->flags[base] = start == -1 ? 0 : flags;
+  state->depth = base + 1;
+}
+
+// Merges the stack at the end of an edge into the entry of `target`, reporting any change.
+static bool merge(Ir* ir, int target, State* state) {
+  Block* block = &ir->blocks[target];
+
+  if (block->depth == -1) {
+    block->depth = state->depth;
+    block->entry = MEM_ALLOC(int, state->depth + 1);
+    block->phis = MEM_ALLOC(int, state->depth + 1);
+
+    for (int i = 0; i < state->depth; i++) {
+      block->entry[i] = state->values[i];
+      block->phis[i] = -1;
+    }
+
+    return true;
+  }
+
+  if (block->depth != state->depth) {
+    ir->failed = true;
+    return false;
+  }
+
+  bool changed = false;
+
+  for (int i = 0; i < state->depth; i++) {
+    if (block->entry[i] == state->values[i]) {
+      continue;
+    }
+
+    if (block->phis[i] == -1) {
+      block->phis[i] = value_new(ir, target, true, OP_NIL, 0);
+    }
+
+    if (block->entry[i] != block->phis[i]) {
+      block->entry[i] = block->phis[i];
+      changed = true;
+    }
+  }
+
+  return changed;
+}
+
+// Finds the stack on entry to every block, merging values where control flow joins until
+// nothing changes. Returns false if the code can't be followed.
+static bool analyze(Ir* ir) {
+  ir->value_len = 0;
+
+  for (int b = 0; b < ir->len; b++) {
+    block_reset(&ir->blocks[b]);
+
+    for (int i = 0; i < ir->blocks[b].len; i++) {
+      ir->blocks[b].instrs[i].value = -1;
+    }
+  }
+
+  // The callee followed by the arguments.
+  State state;
+  state.depth = ir->function->arity + 1;
+
+  for (int i = 0; i < state.depth; i++) {
+    state.values[i] = value_new(ir, -1, false, OP_NIL, 0);
+  }
+
+  merge(ir, 0, &state);
+
+  Numbering numbering = {NULL, 0, 0};
+  bool changed = true;
+
+  while (changed && !ir->failed) {
+    changed = false;
+
+    for (int b = 0; b < ir->len && !ir->failed; b++) {
+      Block* block = &ir->blocks[b];
+
+      if (block->depth == -1) {
+        continue;
+      }
+
+      state_enter(block, &state);
+      numbering.len = 0;
+
+      for (int i = 0; i < block->len && !ir->failed; i++) {
+        Instr* instr = &block->instrs[i];
+
+        if (op_keeps_operand(instr->op)) {
+          changed |= merge(ir, instr->target, &state);
+        }
+
+        step(ir, b, i, &state, &numbering);
+
+        if (instr->target != -1 && !op_keeps_operand(instr->op)) {
+          changed |= merge(ir, instr->target, &state);
+        }
+      }
+
+      if (block->len == 0 || op_falls_through(block->instrs[block->len - 1].op)) {
+        if (b + 1 == ir->len) {
+          ir->failed = true;
+        } else {
+          changed |= merge(ir, b + 1, &state);
+        }
+      }
+    }
+  }
+
+  MEM_FREE_ARRAY(Number, numbering.entries, numbering.capacity);
+  return !ir->failed;
+}
+
+// The blocks control can go to from `b`, at most two.
+static int block_successors(Ir* ir, int b, int successors[2]) {
+  Block* block = &ir->blocks[b];
+  int len = 0;
+
+  if (block->len > 0 && block->instrs[block->len - 1].target != -1) {
+    successors[len++] = block->instrs[block->len - 1].target;
+  }
+
+  if ((block->len == 0 || op_falls_through(block->instrs[block->len - 1].op)) &&
+      b + 1 < ir->len) {
+    successors[len++] = b + 1;
+  }
+
+  return len;
+}
+
+// Folds the operation at `idx` if its operands are constants loaded right before it. Returns the
+// index of the load replacing it, or -1. An operand computed in an earlier block starts at -1, so
+// the operands have to fit in the block before the start of the result can be trusted.
+static int fold(Ir* ir, int b, int idx, State* state, Numbering* numbering) {
+  Block* block = &ir->blocks[b];
+  Instr* instr = &block->instrs[idx];
+  int pops, pushes;
+
+  if (!op_is_numbered(instr->op) || !stack_effect(instr, &pops, &pushes) || idx < pops ||
+      state->starts[state->depth - 1] != idx - pops) {
+    return -1;
+  }
+
+  for (int i = idx - pops; i < idx; i++) {
+    if (!op_is_constant(block->instrs[i].op)) {
+      return -1;
+    }
+  }
+
+  Value a = instr_constant(ir, &block->instrs[idx - pops]);
+  Value result;
+  Instr load;
+
+  bool folded = pops == 1
+                  ? fold_unary(instr->op, a, &result)
+                  : fold_binary(instr->op, a, instr_constant(ir, &block->instrs[idx - 1]), &result);
+
+  if (!folded) {
+    return -1;
+  }
+
+  if (!constant_instr(ir, result, instr->line, &load)) {
+    return -1;
+  }
+
+  block_splice(ir, block, idx - pops, idx + 1, &load, 1);
+  state->depth -= 1;
+  step(ir, b, idx - pops, state, numbering);
+
+  return idx - pops;
+}
+
+// Copy propagation. A read of a local holding a constant, even one copied over from another
+// local, loads the constant instead, and operations on constants are folded.
+static bool propagate_copies(Ir* ir) {
+  State state;
+  Numbering numbering = {NULL, 0, 0};
+  bool changed = false;
+
+  for (int b = 0; b < ir->len && !ir->failed; b++) {
+    Block* block = &ir->blocks[b];
+
+    if (block->depth == -1) {
+      continue;
+    }
+
+    state_enter(block, &state);
+    numbering.len = 0;
+
+    for (int i = 0; i < block->len && !ir->failed; i++) {
+      Instr* instr = &block->instrs[i];
+
+      if (instr->op == OP_GET_LOCAL && instr->arg < state.depth && !ir->captured[instr->arg]) {
+        ValueDef* def = &ir->values[state.values[instr->arg]];
+
+        if (def->block != -1 && !def->is_phi && op_is_constant(def->op)) {
+          instr->op = def->op;
+          instr->arg = def->arg;
+          instr->value = -1;
+          changed = true;
+        }
+      }
+
+      step(ir, b, i, &state, &numbering);
+
+      int folded = ir->failed ? -1 : fold(ir, b, i, &state, &numbering);
+
+      if (folded != -1) {
+        i = folded;
+        changed = true;
+      }
+    }
+  }
+
+  MEM_FREE_ARRAY(Number, numbering.entries, numbering.capacity);
+  return changed;
+}
+
+// Whether the OP_POP at `idx` drops a value just stored to a variable that is then read back.
+static bool forwards_store(Ir* ir, Block* block, int idx) {
+  if (idx == 0 || idx + 1 >= block->len || block->instrs[idx].op != OP_POP) {
+    return false;
+  }
+
+  Instr* store = &block->instrs[idx - 1];
+  Instr* load = &block->instrs[idx + 1];
+
+  switch (store->op) {
+    case OP_SET_LOCAL:
+      return load->op == OP_GET_LOCAL && load->arg == store->arg;
+
+    case OP_SET_UPVALUE:
+      return load->op == OP_GET_UPVALUE && load->arg == store->arg;
+
+    case OP_SET_GLOBAL:
+      return load->op == OP_GET_GLOBAL &&
+             same_constant(instr_constant(ir, store), instr_constant(ir, load));
+
+    default:
+      return false;
+  }
+}
+
+// A stack slot below `top` that can be read for `value`, or -1.
+static int slot_holding(Ir* ir, State* state, int value, int top) {
+  for (int slot = top - 1; slot >= 0; slot--) {
+    if (state->values[slot] == value && slot <= UINT8_MAX && !ir->captured[slot]) {
+      return slot;
+    }
+  }
+
+  return -1;
+}
+
+// Common subexpression elimination. An expression giving a value that some stack slot already
+// holds is replaced by a read of that slot. Reading a variable back right after storing to it
+// keeps the stored value instead.
+static bool eliminate_common(Ir* ir) {
+  State state;
+  Numbering numbering = {NULL, 0, 0};
+  bool changed = false;
+
+  for (int b = 0; b < ir->len && !ir->failed; b++) {
+    Block* block = &ir->blocks[b];
+
+    if (block->depth == -1) {
+      continue;
+    }
+
+    state_enter(block, &state);
+    numbering.len = 0;
+
+    for (int i = 0; i < block->len && !ir->failed; i++) {
+      if (forwards_store(ir, block, i)) {
+        block_splice(ir, block, i, i + 2, NULL, 0);
+        changed = true;
+        i--;
+        continue;
+      }
+
+      step(ir, b, i, &state, &numbering);
+
+      int top = state.depth - 1;
+
+      if (ir->failed || !instr_pushes(&block->instrs[i]) || !(state.flags[top] & TREE_PURE) ||
+          state.starts[top] == i) {
+        continue;
+      }
+
+      int slot = slot_holding(ir, &state, state.values[top], top);
+
+      if (slot != -1) {
+        int start = state.starts[top];
+        Instr read = {
+          .op = OP_GET_LOCAL,
+          .arg = (uint8_t) slot,
+          .line = block->instrs[i].line,
+          .target = -1,
+          .value = -1,
+        };
+
+        block_splice(ir, block, start, i + 1, &read, 1);
+        state.depth -= 1;
+        step(ir, b, start, &state, &numbering);
+
+        i = start;
+        changed = true;
+      }
+    }
+  }
+
+  MEM_FREE_ARRAY(Number, numbering.entries, numbering.capacity);
+  return changed;
+}
+
+static bool loop_writes(Ir* ir, int header, int latch, uint8_t op, Value name) {
+  for (int b = header; b <= latch; b++) {
+    for (int i = 0; i < ir->blocks[b].len; i++) {
+      Instr* instr = &ir->blocks[b].instrs[i];
+
+      if (instr->op == OP_CALL || instr->op == OP_INVOKE || instr->op == OP_SUPER_INVOKE) {
+        return true;
+      }
+
+      if (instr->op == op || (op == OP_SET_GLOBAL && instr->op == OP_DEFINE_GLOBAL)) {
+        if (op == OP_SET_UPVALUE ? instr->arg == AS_INT(name)
+                                 : same_constant(instr_constant(ir, instr), name)) {
+          return true;
+        }
+      }
+    }
+  }
+
+  return false;
+}
+
+// Whether the instruction at `idx` of the loop header gives the same value on every iteration,
+// given which of the slots it pops do.
+static bool is_invariant(Ir* ir, int header, int latch, Instr* instr, State* state,
+                         bool* invariant) {
+  int pops, pushes;
+  stack_effect(instr, &pops, &pushes);
+
+  if (op_is_constant(instr->op)) {
+    return true;
+  }
+
+  if (op_is_numbered(instr->op)) {
+    for (int i = state->depth - pops; i < state->depth; i++) {
+      if (!invariant[i]) {
+        return false;
+      }
+    }
+
+    return true;
+  }
+
+  switch (instr->op) {
+    case OP_GET_LOCAL: {
+      if (instr->arg >= ir->blocks[header].depth || ir->captured[instr->arg]) {
+        return false;
+      }
+
+      int block = ir->values[state->values[instr->arg]].block;
+      return block < header || block > latch;
+    }
+
+    case OP_GET_GLOBAL:
+      return !loop_writes(ir, header, latch, OP_SET_GLOBAL, instr_constant(ir, instr));
+
+    case OP_GET_UPVALUE:
+      return !loop_writes(ir, header, latch, OP_SET_UPVALUE, INT_VAL(instr->arg));
+
+    default:
+      return false;
+  }
+}
+
+static void shift_slots(Ir* ir, Instr* instr, int from) {
+  switch (instr->op) {
+    case OP_GET_LOCAL:
+    case OP_SET_LOCAL:
+    case OP_INC_LOCAL:
+    case OP_CHECK_INT:
+    case OP_CHECK_FLOAT:
+    case OP_FOR_PREP:
+    case OP_FOR_LOOP:
+      if (instr->arg >= from) {
+        instr->arg += 1;
+      }
+      break;
+
+    case OP_CLOSURE:
+      for (int i = 0; i < closure_function(ir, instr)->upvalue_len; i++) {
+        if (instr->captures[2 * i] != CAPTURE_UPVALUE && instr->captures[2 * i + 1] >= from) {
+          instr->captures[2 * i + 1] += 1;
+        }
+      }
+      break;
+
+    default:
+      break;
+  }
+}
+
+// Whether the slots used in the loop from `from` up can all move up by one.
+static bool can_shift_slots(Ir* ir, int header, int latch, int from) {
+  for (int b = header; b <= latch; b++) {
+    for (int i = 0; i < ir->blocks[b].len; i++) {
+      Instr* instr = &ir->blocks[b].instrs[i];
+      int slot = instr->arg;
+
+      switch (instr->op) {
+        case OP_GET_LOCAL:
+        case OP_SET_LOCAL:
+        case OP_INC_LOCAL:
+        case OP_CHECK_INT:
+        case OP_CHECK_FLOAT:
+          break;
+
+        case OP_FOR_PREP:
+        case OP_FOR_LOOP:
+          slot += 3;
+          break;
+
+        case OP_CLOSURE:
+          slot = 0;
+
+          for (int j = 0; j < closure_function(ir, instr)->upvalue_len; j++) {
+            if (instr->captures[2 * j] != CAPTURE_UPVALUE && instr->captures[2 * j + 1] > slot) {
+              slot = instr->captures[2 * j + 1];
+            }
+          }
+          break;
+
+        default:
+          continue;
+      }
+
+      if (slot >= from && slot >= UINT8_MAX) {
+        return false;
+      }
+    }
+  }
+
+  return true;
+}
+
+// Moves the instructions [start, end] of the loop header into a new block run once before the
+// loop. Their value is kept in a new slot on top of the locals of the loop, which is popped in a
+// new block on the way out.
+static void hoist(Ir* ir, int header, int latch, int start, int end) {
+  Block* block = &ir->blocks[header];
+  int slot = block->depth;
+  int len = end - start + 1;
+
+  Instr* moved = MEM_ALLOC(Instr, len);
+  memcpy(moved, &block->instrs[start], sizeof(Instr) * (size_t) len);
+
+  Instr read = {
+    .op = OP_GET_LOCAL,
+    .arg = (uint8_t) slot,
+    .line = block->instrs[end].line,
+    .target = -1,
+    .value = -1,
+  };
+
+  Instr pop = {
+    .op = OP_POP,
+    .line = ir->blocks[latch].len > 0 ? ir->blocks[latch].instrs[ir->blocks[latch].len - 1].line
+                                      : read.line,
+    .target = -1,
+    .value = -1,
+  };
+
+  for (int b = header; b <= latch; b++) {
+    for (int i = 0; i < ir->blocks[b].len; i++) {
+      shift_slots(ir, &ir->blocks[b].instrs[i], slot);
+    }
+  }
+
+  // The moved instructions are pure, so splicing them out frees nothing they still use.
+  block_splice(ir, block, start, end + 1, &read, 1);
+
+  Block* preheader = ir_insert_block(ir, header);
+
+  for (int i = 0; i < len; i++) {
+    block_push(preheader, moved[i]);
+  }
+
+  MEM_FREE_ARRAY(Instr, moved, len);
+
+  header += 1;
+  latch += 1;
+
+  for (int b = 0; b < ir->len; b++) {
+    for (int i = 0; i < ir->blocks[b].len && (b < header || b > latch); i++) {
+      if (ir->blocks[b].instrs[i].target == header) {
+        ir->blocks[b].instrs[i].target = header - 1;
+      }
+    }
+  }
+
+  block_push(ir_insert_block(ir, latch + 1), pop);
+
+  for (int b = header; b <= latch; b++) {
+    for (int i = 0; i < ir->blocks[b].len; i++) {
+      if (ir->blocks[b].instrs[i].target == latch + 2) {
+        ir->blocks[b].instrs[i].target = latch + 1;
+      }
+    }
+  }
+
+  find_captures(ir);
+}
+
+// Looks for an invariant expression in the first block of the loop [header, latch] and hoists it.
+// That block runs whenever the loop is entered, so an expression there is evaluated at least
+// once, as long as nothing that can fail or be observed runs before it.
+static bool hoist_from_loop(Ir* ir, int header, int latch) {
+  Block* block = &ir->blocks[header];
+
+  if (block->depth == -1 || block->depth > UINT8_MAX || latch + 1 >= ir->len ||
+      ir->blocks[latch + 1].depth != block->depth) {
+    return false;
+  }
+
+  // The loop is entered at the header only, and left to the block right after it.
+  for (int b = 0; b < ir->len; b++) {
+    int successors[2];
+    int len = block_successors(ir, b, successors);
+    bool is_inside = b >= header && b <= latch;
+
+    for (int i = 0; i < len; i++) {
+      if (is_inside ? (successors[i] < header || successors[i] > latch + 1)
+                    : (successors[i] > header && successors[i] <= latch)) {
+        return false;
+      }
+    }
+  }
+
+  if (!can_shift_slots(ir, header, latch, block->depth)) {
+    return false;
+  }
+
+  State state;
+  Numbering numbering = {NULL, 0, 0};
+  bool invariant[STACK_SLOTS_MAX] = {false};
+  int barrier = -1;
+
+  state_enter(block, &state);
+
+  for (int i = 0; i < block->len && !ir->failed; i++) {
+    Instr* instr = &block->instrs[i];
+    int pops, pushes;
+    stack_effect(instr, &pops, &pushes);
+
+    bool is_result_invariant =
+        pushes == 1 && is_invariant(ir, header, latch, instr, &state, invariant);
+
+    for (int k = state.depth - pops; k < state.depth && !is_result_invariant; k++) {
+      int start = state.starts[k];
+      int end = k + 1 < state.depth ? state.starts[k + 1] - 1 : i - 1;
+
+      if (end < start || !invariant[k] || !(state.flags[k] & TREE_PURE) || instr->op == OP_POP ||
+          (start == end && block->instrs[start].op != OP_GET_GLOBAL) ||
+          (!(state.flags[k] & TREE_SAFE) && barrier != -1 && barrier < start)) {
+        continue;
+      }
+
+      MEM_FREE_ARRAY(Number, numbering.entries, numbering.capacity);
+      hoist(ir, header, latch, start, end);
+      return true;
+    }
+
+    if (barrier == -1 && !op_is_safe(instr->op) && instr->op != OP_SET_LOCAL &&
+        instr->op != OP_POP) {
+      barrier = i;
+    }
+
+    step(ir, header, i, &state, &numbering);
+
+    if (pushes == 1) {
+      invariant[state.depth - 1] = is_result_invariant;
+    }
+  }
+
+  MEM_FREE_ARRAY(Number, numbering.entries, numbering.capacity);
+  return false;
+}
+
+// Loop-invariant code motion, moving one expression out of the innermost loop that has one.
+static bool hoist_invariants(Ir* ir) {
+  int len = ir->len;
+  int* latches = MEM_ALLOC(int, len);
+  bool hoisted = false;
+
+  // The last block jumping back to each header.
+  for (int b = 0; b < len; b++) {
+    latches[b] = -1;
+  }
+
+  for (int b = 0; b < len; b++) {
+    Block* block = &ir->blocks[b];
+
+    if (block->len > 0 && op_jumps_back(block->instrs[block->len - 1].op)) {
+      latches[block->instrs[block->len - 1].target] = b;
+    }
+  }
+
+  for (int size = 0; size < len && !hoisted; size++) {
+    for (int b = 0; b + size < len && !hoisted; b++) {
+      if (latches[b] == b + size) {
+        hoisted = hoist_from_loop(ir, b, b + size);
+      }
+    }
+  }
+
+  MEM_FREE_ARRAY(int, latches, len);
+  return hoisted;
+}
+
+static inline void slots_add(SlotSet* set, int slot) {
+  if (slot >= 0 && slot <= UINT8_MAX) {
+    set->bits[slot / 64] |= (uint64_t) 1 << (slot % 64);
+  }
+}
+
+static inline void slots_remove(SlotSet* set, int slot) {
+  if (slot >= 0 && slot <= UINT8_MAX) {
+    set->bits[slot / 64] &= ~((uint64_t) 1 << (slot % 64));
+  }
+}
+
+static inline bool slots_contain(SlotSet* set, int slot) {
+  return (set->bits[slot / 64] >> (slot % 64)) & 1;
+}
+
+// Goes back over an instruction, given the stack depth before it, updating the slots that are
+// read before being written again.
+static void live_step(Instr* instr, int depth, SlotSet* live) {
+  int pops, pushes;
+  stack_effect(instr, &pops, &pushes);
+
+  for (int i = depth - pops; i < depth - pops + pushes; i++) {
+    slots_remove(live, i);
+  }
+
+  switch (instr->op) {
+    case OP_GET_LOCAL:
+    case OP_INC_LOCAL:
+    case OP_CHECK_INT:
+    case OP_CHECK_FLOAT:
+      slots_add(live, instr->arg);
+      break;
+
+    case OP_SET_LOCAL:
+      slots_remove(live, instr->arg);
+      break;
+
+    case OP_FOR_PREP:
+    case OP_FOR_LOOP:
+      slots_remove(live, instr->arg);
+
+      for (int i = 1; i < 4; i++) {
+        slots_add(live, instr->arg + i);
+      }
+      break;
+
+    case OP_JUMP_UNLESS_CALLEE:
+      slots_add(live, depth - 1 - instr->arg2);
+      break;
+
+    case OP_RETURN:
+      memset(live, 0, sizeof(SlotSet));
+      break;
+
+    default:
+      break;
+  }
+
+  // Slots taken straight off the stack. Locals are popped at the end of their scope, which
+  // doesn't read them.
+  int reads = instr->op == OP_POP ? 0 : pops;
+
+  switch (instr->op) {
+    case OP_SET_LOCAL:
+    case OP_SET_GLOBAL:
+    case OP_SET_UPVALUE:
+    case OP_DUP:
+      reads = 1;
+      break;
+
+    case OP_METHOD:
+    case OP_INHERIT:
+      reads = 2;
+      break;
+
+    default:
+      break;
+  }
+
+  for (int i = depth - reads; i < depth; i++) {
+    slots_add(live, i);
+  }
+}
+
+// Stack depth before each instruction of a reachable block.
+static void block_depths(Block* block, int* depths) {
+  depths[0] = block->depth;
+
+  for (int i = 0; i < block->len; i++) {
+    int pops, pushes;
+    stack_effect(&block->instrs[i], &pops, &pushes);
+    depths[i + 1] = depths[i] - pops + pushes;
+  }
+}
+
+static SlotSet live_out(Ir* ir, int b, SlotSet* live_in) {
+  SlotSet live = {{0}};
+  int successors[2];
+  int len = block_successors(ir, b, successors);
+
+  for (int i = 0; i < len; i++) {
+    for (int j = 0; j < (UINT8_MAX + 1) / 64; j++) {
+      live.bits[j] |= live_in[successors[i]].bits[j];
+    }
+  }
+
+  return live;
+}
+
+// The slots live on entry to block `b`. With `removed` set, stores to slots that aren't read
+// afterwards are dropped on the way.
+static SlotSet live_through(Ir* ir, int b, SlotSet* live_in, bool* removed) {
+  Block* block = &ir->blocks[b];
+  int len = block->len;
+  int* depths = MEM_ALLOC(int, len + 1);
+  SlotSet live = live_out(ir, b, live_in);
+
+  block_depths(block, depths);
+
+  for (int i = len - 1; i >= 0; i--) {
+    Instr* instr = &block->instrs[i];
+
+    if (removed != NULL && instr->op == OP_SET_LOCAL && !ir->captured[instr->arg] &&
+        !slots_contain(&live, instr->arg)) {
+      block_splice(ir, block, i, i + 1, NULL, 0);
+      *removed = true;
+      continue;
+    }
+
+    live_step(instr, depths[i], &live);
+  }
+
+  MEM_FREE_ARRAY(int, depths, len + 1);
+  return live;
+}
+
+// Dead store elimination. A store to a local that is never read before the local is written
+// again or goes out of scope is dropped.
+static bool eliminate_dead_stores(Ir* ir) {
+  SlotSet* live_in = MEM_ALLOC(SlotSet, ir->len);
+  bool changed = true;
+  bool removed = false;
+
+  memset(live_in, 0, sizeof(SlotSet) * (size_t) ir->len);
+
+  while (changed) {
+    changed = false;
+
+    for (int b = ir->len - 1; b >= 0; b--) {
+      if (ir->blocks[b].depth == -1) {
+        continue;
+      }
+
+      SlotSet live = live_through(ir, b, live_in, NULL);
+
+      if (memcmp(&live, &live_in[b], sizeof(SlotSet)) != 0) {
+        live_in[b] = live;
+        changed = true;
+      }
+    }
+  }
+
+  for (int b = 0; b < ir->len; b++) {
+    if (ir->blocks[b].depth != -1) {
+      live_through(ir, b, live_in, &removed);
+    }
+  }
+
+  MEM_FREE_ARRAY(SlotSet, live_in, ir->len);
+  return removed;
+}
+
+// Drops expressions whose value is popped right away, if computing them can't fail.
+static bool drop_unused(Ir* ir) {
+  State state;
+  Numbering numbering = {NULL, 0, 0};
+  bool changed = false;
+
+  for (int b = 0; b < ir->len && !ir->failed; b++) {
+    Block* block = &ir->blocks[b];
+
+    if (block->depth == -1) {
+      continue;
+    }
+
+    state_enter(block, &state);
+    numbering.len = 0;
+
+    for (int i = 0; i < block->len && !ir->failed; i++) {
+      int top = state.depth - 1;
+
+      if (block->instrs[i].op == OP_POP && top >= 0 && (state.flags[top] & TREE_SAFE)) {
+        int start = state.starts[top];
+
+        block_splice(ir, block, start, i + 1, NULL, 0);
+        state.depth -= 1;
+
+        if (top > 0) {
+          state.flags[top - 1] = 0;
+        }
+
+        i = start - 1;
+        changed = true;
+        continue;
+      }
+
+      step(ir, b, i, &state, &numbering);
+    }
+  }
+
+  MEM_FREE_ARRAY(Number, numbering.entries, numbering.capacity);
+  return changed;
+}
+
+// The kinds a value can have. A value no path has reached yet has none.
+typedef enum {
+  TYPE_INT = 1,
+  TYPE_FLOAT = 2,
+  TYPE_OTHER = 4,
+
+  TYPE_NUMBER = TYPE_INT | TYPE_FLOAT,
+  TYPE_ANY = TYPE_NUMBER | TYPE_OTHER,
+} Type;
+
+static uint8_t constant_type(Value value) {
+  return IS_INT(value) ? TYPE_INT : (IS_NUMBER(value) ? TYPE_FLOAT : TYPE_OTHER);
+}
+
+// Arithmetic on two integers gives an integer, and a double on either side gives a double.
+static uint8_t arith_type(uint8_t a, uint8_t b) {
+  uint8_t type = a & b & TYPE_INT;
+
+  if (((a | b) & TYPE_FLOAT) && (a & TYPE_NUMBER) && (b & TYPE_NUMBER)) {
+    type |= TYPE_FLOAT;
+  }
+
+  return type;
+}
+
+// The kinds of the value `instr` gives, from the stack before it. For a numeric for loop, the
+// slot at `offset` from its first one.
+static uint8_t result_type(Ir* ir, Instr* instr, State* state, uint8_t* types, int offset) {
+  uint8_t a = state->depth >= 2 ? types[state->values[state->depth - 2]] : 0;
+  uint8_t b = state->depth >= 1 ? types[state->values[state->depth - 1]] : 0;
+  int slot = instr->arg;
+
+  if (op_is_constant(instr->op)) {
+    return constant_type(instr_constant(ir, instr));
+  }
+
+  // Slots past the stack make the analysis fail anyway.
+  bool is_slot_op = instr->op == OP_GET_LOCAL || instr->op == OP_INC_LOCAL ||
+                    op_shape(instr->op) == SHAPE_SLOT_JUMP;
+
+  if (is_slot_op && (op_shape(instr->op) == SHAPE_SLOT_JUMP ? slot + 3 : slot) >= state->depth) {
+    return TYPE_ANY;
+  }
+
+  switch (instr->op) {
+    case OP_GET_LOCAL:
+      return ir->captured[slot] ? TYPE_ANY : types[state->values[slot]];
+
+    case OP_DUP:
+      return b;
+
+    case OP_INC_LOCAL:
+      return types[state->values[slot]] & TYPE_NUMBER;
+
+    case OP_CHECK_INT:
+    case OP_BIT_NOT:
+    case OP_BIT_AND:
+    case OP_BIT_OR:
+    case OP_BIT_XOR:
+    case OP_SHIFT_LEFT:
+    case OP_SHIFT_RIGHT:
+    case OP_ADD_INT:
+    case OP_SUBTRACT_INT:
+    case OP_MULTIPLY_INT:
+      return TYPE_INT;
+
+    case OP_CHECK_FLOAT:
+    case OP_ADD_NUM:
+    case OP_SUBTRACT_NUM:
+    case OP_MULTIPLY_NUM:
+      return TYPE_FLOAT;
+
+    case OP_NEGATE:
+      return b & TYPE_NUMBER;
+
+    case OP_ADD:
+      return arith_type(a, b) | (((a | b) & TYPE_OTHER) ? TYPE_OTHER : 0);
+
+    case OP_SUBTRACT:
+    case OP_MULTIPLY:
+    case OP_MODULO:
+      return arith_type(a, b);
+
+    case OP_DIVIDE:
+      return (a & TYPE_NUMBER) && (b & TYPE_NUMBER) ? TYPE_FLOAT : 0;
+
+    // The bounds become all integers or all doubles. The loop then keeps their kind.
+    case OP_FOR_PREP: {
+      uint8_t start = types[state->values[slot + 1]];
+      uint8_t limit = types[state->values[slot + 2]];
+      uint8_t step = types[state->values[slot + 3]];
+
+      return (start & limit & step & TYPE_INT) |
+             (((start | limit | step) & TYPE_FLOAT) ? TYPE_FLOAT : 0);
+    }
+
+    case OP_FOR_LOOP:
+      return types[state->values[slot + (offset == 0 ? 1 : offset)]];
+
+    default:
+      return op_is_numbered(instr->op) ? TYPE_OTHER : TYPE_ANY;
+  }
+}
+
+static bool widen(uint8_t* types, int value, uint8_t type) {
+  if ((types[value] | type) == types[value]) {
+    return false;
+  }
+
+  types[value] |= type;
+  return true;
+}
+
+// Merges the kinds of the values on an edge into the phis of `target`.
+static bool widen_phis(Ir* ir, int target, State* state, uint8_t* types) {
+  Block* block = &ir->blocks[target];
+  bool changed = false;
+
+  for (int i = 0; i < state->depth && i < block->depth; i++) {
+    if (block->phis[i] != -1) {
+      changed |= widen(types, block->phis[i], types[state->values[i]]);
+    }
+  }
+
+  return changed;
+}
+
+// Finds the kinds every SSA value can have, widening them along every path until nothing
+// changes. Arguments and the values of calls, fields and the like can be anything.
+static uint8_t* infer_types(Ir* ir) {
+  uint8_t* types = MEM_ALLOC(uint8_t, ir->value_len);
+  State state;
+  Numbering numbering = {NULL, 0, 0};
+  bool changed = true;
+
+  for (int i = 0; i < ir->value_len; i++) {
+    types[i] = ir->values[i].block == -1 ? TYPE_ANY : 0;
+  }
+
+  while (changed && !ir->failed) {
+    changed = false;
+
+    for (int b = 0; b < ir->len && !ir->failed; b++) {
+      Block* block = &ir->blocks[b];
+
+      if (block->depth == -1) {
+        continue;
+      }
+
+      state_enter(block, &state);
+      numbering.len = 0;
+
+      for (int i = 0; i < block->len && !ir->failed; i++) {
+        Instr* instr = &block->instrs[i];
+        int pops, pushes;
+        uint8_t results[4];
+        int len = op_shape(instr->op) == SHAPE_SLOT_JUMP ? 4 : 1;
+
+        stack_effect(instr, &pops, &pushes);
+
+        for (int j = 0; j < len; j++) {
+          results[j] = result_type(ir, instr, &state, types, j);
+        }
+
+        if (op_keeps_operand(instr->op)) {
+          changed |= widen_phis(ir, instr->target, &state, types);
+        }
+
+        step(ir, b, i, &state, &numbering);
+
+        if (ir->failed) {
+          break;
+        }
+
+        if (pushes == 1) {
+          changed |= widen(types, state.values[state.depth - 1], results[0]);
+        } else if (instr->op == OP_INC_LOCAL || instr->op == OP_CHECK_INT ||
+                   instr->op == OP_CHECK_FLOAT || len == 4) {
+          for (int j = 0; j < len; j++) {
+            changed |= widen(types, state.values[instr->arg + j], results[j]);
+          }
+        }
+
+        if (instr->target != -1 && !op_keeps_operand(instr->op)) {
+          changed |= widen_phis(ir, instr->target, &state, types);
+        }
+      }
+
+      if (!ir->failed && (block->len == 0 || op_falls_through(block->instrs[block->len - 1].op))) {
+        changed |= widen_phis(ir, b + 1, &state, types);
+      }
+    }
+  }
+
+  MEM_FREE_ARRAY(Number, numbering.entries, numbering.capacity);
+  return types;
+}
+
+// The variant of `op` for operands that are both integers or both doubles, if there is one.
+static bool typed_op(uint8_t op, uint8_t type, uint8_t* dest) {
+#define TYPED(op)                                   \
+  case op:                                          \
+    *dest = type == TYPE_INT ? op##_INT : op##_NUM; \
+    return true
+
+  switch (op) {
+    TYPED(OP_ADD);
+    TYPED(OP_SUBTRACT);
+    TYPED(OP_MULTIPLY);
+    TYPED(OP_LESSER);
+    TYPED(OP_GREATER);
+    TYPED(OP_LESSER_EQUAL);
+    TYPED(OP_GREATER_EQUAL);
+    TYPED(OP_JUMP_UNLESS_LESSER);
+    TYPED(OP_JUMP_UNLESS_GREATER);
+    TYPED(OP_JUMP_UNLESS_LESSER_EQUAL);
+    TYPED(OP_JUMP_UNLESS_GREATER_EQUAL);
+
+    default:
+      return false;
+  }
+#undef TYPED
+}
+
+// Switches arithmetic and comparisons on operands known to be two integers or two doubles to
+// the variants that don't check them.
+static void specialize_types(Ir* ir) {
+  uint8_t* types = infer_types(ir);
+  State state;
+  Numbering numbering = {NULL, 0, 0};
+
+  for (int b = 0; b < ir->len && !ir->failed; b++) {
+    Block* block = &ir->blocks[b];
+
+    if (block->depth == -1) {
+      continue;
+    }
+
+    state_enter(block, &state);
+    numbering.len = 0;
+
+    for (int i = 0; i < block->len && !ir->failed; i++) {
+      Instr* instr = &block->instrs[i];
+
+      if (state.depth >= 2) {
+        uint8_t left = types[state.values[state.depth - 2]];
+        uint8_t right = types[state.values[state.depth - 1]];
+
+        if (left == right && (left == TYPE_INT || left == TYPE_FLOAT)) {
+          typed_op(instr->op, left, &instr->op);
+        }
+      }
+
+      step(ir, b, i, &state, &numbering);
+    }
+  }
+
+  MEM_FREE_ARRAY(Number, numbering.entries, numbering.capacity);
+  MEM_FREE_ARRAY(uint8_t, types, ir->value_len);
+}
+
+static bool op_can_inline(uint8_t op) {
+  switch (op) {
+    case OP_GET_GLOBAL:
+    case OP_SET_GLOBAL:
+    case OP_GET_LOCAL:
+    case OP_SET_LOCAL:
+    case OP_INC_LOCAL:
+    case OP_CHECK_INT:
+    case OP_CHECK_FLOAT:
+    case OP_GET_PROPERTY:
+    case OP_SET_PROPERTY:
+    case OP_INDEX_GET:
+    case OP_INDEX_SET:
+    case OP_LIST:
+    case OP_MAP:
+    case OP_POP:
+    case OP_DUP:
+    case OP_PRINT:
+      return true;
+
+    default:
+      return op_is_constant(op) || op_is_numbered(op);
+  }
+}
+
+// Decodes `callee` into `body` if it is small enough to inline and has no calls, closures or
+// control flow of its own. Returns the number of instructions before its return, or -1, and
+// sets `depth` to the size of its frame at the return, the result included.
+static int inline_body(ObjFunction* callee, Instr* body, int* depth) {
+  Ir ir;
+  ir_init(&ir, callee);
+
+  if (callee->upvalue_len > 0 || !ir_build(&ir) || ir.len != 1) {
+    ir_free(&ir);
+    return -1;
+  }
+
+  Block* block = &ir.blocks[0];
+  int len = block->len - 1;
+
+  *depth = callee->arity + 1;
+
+  for (int i = 0; i < len && *depth + len + 1 <= INLINE_INSTRS_MAX; i++) {
+    Instr* instr = &block->instrs[i];
+    int pops, pushes;
+
+    if (!op_can_inline(instr->op) || !stack_effect(instr, &pops, &pushes) || *depth - pops < 1) {
+      len = -1;
+      break;
+    }
+
+    body[i] = *instr;
+    *depth += pushes - pops;
+  }
+
+  if (len != -1 && (block->instrs[len].op != OP_RETURN || *depth < 2 ||
+                    *depth + len + 1 > INLINE_INSTRS_MAX)) {
+    len = -1;
+  }
+
+  ir_free(&ir);
+  return len;
+}
+
+// The function a call through `value` was compiled against, if it was read from a global
+// declared as one.
+static ObjFunction* global_function(Ir* ir, int value, Table* functions) {
+  ValueDef* def = &ir->values[value];
+  Value function;
+
+  if (def->block == -1 || def->is_phi || def->op != OP_GET_GLOBAL ||
+      !table_get(functions, AS_STRING(ir->function->chunk.consts.values[def->arg]), &function) ||
+      !IS_FUNCTION(function)) {
+    return NULL;
+  }
+
+  return AS_FUNCTION(function);
+}
+
+// Whether block `b` is the call a guard falls back to.
+static bool is_fallback(Ir* ir, int b) {
+  for (int g = 0; g < b; g++) {
+    Block* block = &ir->blocks[g];
+
+    if (block->len > 0 && block->instrs[block->len - 1].op == OP_JUMP_UNLESS_CALLEE &&
+        block->instrs[block->len - 1].target == b) {
+      return true;
+    }
+  }
+
+  return false;
+}
+
+// Inlines the call at `idx` of block `b`, whose frame would start at slot `base`. The block is
+// split into a guard checking the callee, the inlined code, the call itself for when the guard
+// fails, and the code after the call. The inlined code runs in the caller's frame, so an error
+// raised in it is reported at the line of the call, without the callee's frame in the stack trace.
+static bool inline_call(Ir* ir, int b, int idx, int base, ObjFunction* callee, Instr* body,
+                        int len, int depth) {
+  Instr call = ir->blocks[b].instrs[idx];
+  int callee_const = constant_index(ir, OBJ_VAL(callee));
+  Instr code[INLINE_INSTRS_MAX];
+  int code_len = 0;
+
+  if (callee_const == -1 || base > UINT8_MAX) {
+    return false;
+  }
+
+  for (int i = 0; i < len; i++) {
+    Instr instr = body[i];
+    int arg = instr.arg;
+
+    switch (instr.op) {
+      case OP_GET_LOCAL:
+      case OP_SET_LOCAL:
+      case OP_INC_LOCAL:
+      case OP_CHECK_INT:
+      case OP_CHECK_FLOAT:
+        arg = base + instr.arg;
+        break;
+
+      case OP_LOAD:
+      case OP_GET_GLOBAL:
+      case OP_SET_GLOBAL:
+      case OP_GET_PROPERTY:
+      case OP_SET_PROPERTY:
+        arg = constant_index(ir, callee->chunk.consts.values[instr.arg]);
+        break;
+
+      default:
+        break;
+    }
+
+    if (arg < 0 || arg > UINT8_MAX) {
+      return false;
+    }
+
+    instr.arg = (uint8_t) arg;
+    instr.line = call.line;
+    code[code_len++] = instr;
+  }
+
+  // The result takes the place of the callee, and the rest of the frame is popped.
+  Instr store = {
+    .op = OP_SET_LOCAL,
+    .arg = (uint8_t) base,
+    .line = call.line,
+    .target = -1,
+    .value = -1,
+  };
+
+  Instr pop = {.op = OP_POP, .line = call.line, .target = -1, .value = -1};
+
+  code[code_len++] = store;
+
+  for (int i = 1; i < depth; i++) {
+    code[code_len++] = pop;
+  }
+
+  for (int i = 0; i < 3; i++) {
+    ir_insert_block(ir, b + 1);
+  }
+
+  Block* block = &ir->blocks[b];
+  Block* inlined = &ir->blocks[b + 1];
+  Block* rest = &ir->blocks[b + 3];
+
+  for (int i = idx + 1; i < block->len; i++) {
+    block_push(rest, block->instrs[i]);
+  }
+
+  block->len = idx;
+  block_push(&ir->blocks[b + 2], call);
+
+  Instr guard = {
+    .op = OP_JUMP_UNLESS_CALLEE,
+    .arg = (uint8_t) callee_const,
+    .arg2 = call.arg,
+    .line = call.line,
+    .target = b + 2,
+    .value = -1,
+  };
+
+  block_push(block, guard);
+
+  for (int i = 0; i < code_len; i++) {
+    block_push(inlined, code[i]);
+  }
+
+  Instr jump = {.op = OP_JUMP, .line = call.line, .target = b + 3, .value = -1};
+  block_push(inlined, jump);
+
+  return true;
+}
+
+// Inlines the first call through a global declared as a small function in `functions`. The
+// global could be assigned another value by then, so a guard checks the callee first.
+static bool inline_calls(Ir* ir, Table* functions) {
+  State state;
+  Numbering numbering = {NULL, 0, 0};
+  bool inlined = false;
+
+  for (int b = 0; b < ir->len && !inlined && !ir->failed; b++) {
+    Block* block = &ir->blocks[b];
+
+    if (block->depth == -1) {
+      continue;
+    }
+
+    state_enter(block, &state);
+    numbering.len = 0;
+
+    for (int i = 0; i < block->len && !inlined && !ir->failed; i++) {
+      Instr* instr = &block->instrs[i];
+
+      if (instr->op == OP_CALL && instr->arg < state.depth && (i > 0 || !is_fallback(ir, b))) {
+        int base = state.depth - 1 - instr->arg;
+        ObjFunction* callee = global_function(ir, state.values[base], functions);
+        Instr body[INLINE_INSTRS_MAX];
+        int depth;
+        int len = callee != NULL && callee->arity == instr->arg ? inline_body(callee, body, &depth)
+                                                                : -1;
+
+        if (len != -1 && inline_call(ir, b, i, base, callee, body, len, depth)) {
+          inlined = true;
+          break;
+        }
+      }
+
+      step(ir, b, i, &state, &numbering);
+    }
+  }
+
+  MEM_FREE_ARRAY(Number, numbering.entries, numbering.capacity);
+  return inlined;
+}
+
+// Writes the blocks back into the chunk of the function, keeping its constants.
+static bool ir_lower(Ir* ir) {
+  int* offsets = MEM_ALLOC(int, ir->len + 1);
+  bool is_valid = true;
+
+  offsets[0] = 0;
+
+  for (int b = 0; b < ir->len; b++) {
+    offsets[b + 1] = offsets[b];
+
+    for (int i = 0; i < ir->blocks[b].len; i++) {
+      offsets[b + 1] += instr_size(ir, &ir->blocks[b].instrs[i]);
+    }
+  }
+
+  Chunk code;
+  chunk_init(&code);
+
+  for (int b = 0; b < ir->len && is_valid; b++) {
+    int offset = offsets[b];
+
+    for (int i = 0; i < ir->blocks[b].len && is_valid; i++) {
+      Instr* instr = &ir->blocks[b].instrs[i];
+      int size = instr_size(ir, instr);
+      int distance = 0;
+
+      if (instr->target != -1) {
+        int end = offset + size;
+        distance = op_jumps_back(instr->op) ? end - offsets[instr->target]
+                                            : offsets[instr->target] - end;
+        is_valid = distance >= 0 && distance <= UINT16_MAX;
+      }
+
+      chunk_write(&code, instr->op, instr->line);
+
+      switch (op_shape(instr->op)) {
+        case SHAPE_NONE:
+          break;
+
+        case SHAPE_BYTE:
+          chunk_write(&code, instr->arg, instr->line);
+          break;
+
+        case SHAPE_TWO_BYTES:
+          chunk_write(&code, instr->arg, instr->line);
+          chunk_write(&code, instr->arg2, instr->line);
+          break;
+
+        case SHAPE_GUARD:
+          chunk_write(&code, instr->arg, instr->line);
+          chunk_write(&code, instr->arg2, instr->line);
+          chunk_write(&code, (distance >> 8) & 0xFF, instr->line);
+          chunk_write(&code, distance & 0xFF, instr->line);
+          break;
+
+        case SHAPE_SLOT_JUMP:
+          chunk_write(&code, instr->arg, instr->line);
+          // Fallthrough.
+
+        case SHAPE_JUMP:
+          chunk_write(&code, (distance >> 8) & 0xFF, instr->line);
+          chunk_write(&code, distance & 0xFF, instr->line);
+          break;
+
+        case SHAPE_CLOSURE:
+          chunk_write(&code, instr->arg, instr->line);
+
+          for (int j = 0; j < size - 2; j++) {
+            chunk_write(&code, instr->captures[j], instr->line);
+          }
+          break;
+      }
+
+      offset += size;
+    }
+  }
+
+  MEM_FREE_ARRAY(int, offsets, ir->len + 1);
+
+  if (!is_valid) {
+    MEM_FREE_ARRAY(uint8_t, code.code, code.capacity);
+    MEM_FREE_ARRAY(uint16_t, code.lines, code.lines_capacity);
+    return false;
+  }
+
+  Chunk* chunk = &ir->function->chunk;
+  MEM_FREE_ARRAY(uint8_t, chunk->code, chunk->capacity);
+  MEM_FREE_ARRAY(uint16_t, chunk->lines, chunk->lines_capacity);
+
+  chunk->code = code.code;
+  chunk->len = code.len;
+  chunk->capacity = code.capacity;
+  chunk->lines = code.lines;
+  chunk->lines_len = code.lines_len;
+  chunk->lines_capacity = code.lines_capacity;
+
+  return true;
+}
+
+void ir_optimize(ObjFunction* function, Table* functions) {
+  Ir ir;
+  ir_init(&ir, function);
+
+  if (ir_build(&ir)) {
+    for (int i = 0; i < INLINES_MAX && analyze(&ir) && inline_calls(&ir, functions); i++) {
+    }
+
+    for (int round = 0; round < ROUNDS_MAX; round++) {
+      bool changed = false;
+
+      changed |= analyze(&ir) && propagate_copies(&ir);
+      changed |= analyze(&ir) && eliminate_common(&ir);
+      changed |= analyze(&ir) && eliminate_dead_stores(&ir);
+      changed |= analyze(&ir) && drop_unused(&ir);
+
+      if (!changed || ir.failed) {
+        break;
+      }
+    }
+
+    for (int i = 0; i < HOISTS_MAX && analyze(&ir) && hoist_invariants(&ir); i++) {
+    }
+
+    if (analyze(&ir)) {
+      specialize_types(&ir);
+    }
+
+    if (!ir.failed) {
+      ir_lower(&ir);
+    }
+  }
+
+  ir_free(&ir);
+}
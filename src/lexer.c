@@ -172,6 +172,19 @@ Token lexer_next(void) {
     return identifier();
   }
 
+  // Shifts share their first character with the comparisons.
+  if ((ch == '<' || ch == '>') && match(ch)) {
+    return emit_token(ch == '<' ? TOKEN_LESSER_LESSER : TOKEN_GREATER_GREATER);
+  }
+
+  if ((ch == '+' || ch == '-') && match(ch)) {
+    return emit_token(ch == '+' ? TOKEN_PLUS_PLUS : TOKEN_MINUS_MINUS);
+  }
+
+  if (ch == '.' && match('.')) {
+    return emit_token(TOKEN_DOT_DOT);
+  }
+
   switch (ch) {
 #define X(x, y) \
   case y:       \
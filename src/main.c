@@ -3,15 +3,31 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "cache.h"
 #include "compiler.h"
+#include "image.h"
 #include "lexer.h"
 #include "object.h"
 #include "vm.h"
 
+// Set by -O on the command line. Small functions are then inlined into their callers, so stack
+// traces aren't faithful: a runtime error inside one is reported at the line of the call, and the
+// frame of the function is missing.
+static bool optimize = false;
+
+// Set by --compile, which writes the compiled script to an image next to it instead of running it.
+static bool compile_only = false;
+
+// Cleared by --no-cache, which always compiles the script instead of looking for it in the cache.
+static bool use_cache = true;
+
+// The image a script was run from. It stays mapped until the VM is freed.
+static Image script_image = {NULL, 0};
+
 static InterpretResult run_source(const char* source) {
   lexer_init(source);
 
-  ObjFunction* function = compiler_compile();
+  ObjFunction* function = compiler_compile(optimize);
 
   if (function == NULL) {
     return INTERPRET_COMPILE_ERROR;
@@ -74,10 +90,98 @@ static char* read_file(const char* path) {
   return buffer;
 }
 
+// `script.wee` is compiled to `script.weec`, and any other path gets `.weec` appended.
+static char* image_path(const char* path) {
+  size_t len = strlen(path);
+
+  if (len >= 4 && strcmp(path + len - 4, ".wee") == 0) {
+    len -= 4;
+  }
+
+  char* image = (char*) malloc(len + sizeof(".weec"));
+
+  if (image == NULL) {
+    fprintf(stderr, "Not enough memory to compile: '%s'.\n", path);
+    exit(EXIT_FAILURE);
+  }
+
+  memcpy(image, path, len);
+  memcpy(image + len, ".weec", sizeof(".weec"));
+
+  return image;
+}
+
+static void compile_file(const char* path, const char* source) {
+  lexer_init(source);
+
+  ObjFunction* function = compiler_compile(optimize);
+
+  if (function == NULL) {
+    fprintf(stderr, "Interpreter returned error code: %d.\n", INTERPRET_COMPILE_ERROR);
+    exit(EXIT_FAILURE);
+  }
+
+  char* image = image_path(path);
+  FILE* file = fopen(image, "wb");
+
+  if (file == NULL || !image_write(function, file) || fclose(file) != 0) {
+    fprintf(stderr, "Could not write file: '%s'.\n", image);
+    exit(EXIT_FAILURE);
+  }
+
+  free(image);
+}
+
+// Runs the image of `source` from the cache if it's there, and caches it once it's compiled
+// otherwise. An image that fails to load is left mapped, since the strings read from it before the
+// failure point into it.
+static ObjFunction* compile_cached(const char* source) {
+  char path[CACHE_PATH_MAX];
+  bool is_cached = use_cache && cache_path(source, optimize, path);
+
+  if (is_cached && image_map(path, &script_image)) {
+    ObjFunction* function = image_read(&script_image);
+
+    if (function != NULL) {
+      return function;
+    }
+  }
+
+  lexer_init(source);
+  ObjFunction* function = compiler_compile(optimize);
+
+  if (is_cached && function != NULL) {
+    cache_store(path, function);
+  }
+
+  return function;
+}
+
 static void run_file(const char* path) {
-  char* source = read_file(path);
-  InterpretResult result = run_source(source);
-  free(source);
+  InterpretResult result;
+
+  if (!compile_only && image_map(path, &script_image)) {
+    ObjFunction* function = image_read(&script_image);
+
+    if (function == NULL) {
+      fprintf(stderr, "Could not load image: '%s'.\n", path);
+      exit(EXIT_FAILURE);
+    }
+
+    result = vm_interpret(function);
+  } else {
+    char* source = read_file(path);
+
+    if (compile_only) {
+      compile_file(path, source);
+      free(source);
+      return;
+    }
+
+    ObjFunction* function = compile_cached(source);
+    result = function == NULL ? INTERPRET_COMPILE_ERROR : vm_interpret(function);
+    free(source);
+  }
 
   if (result != INTERPRET_OK) {
     fprintf(stderr, "Interpreter returned error code: %d.\n", result);
@@ -88,15 +192,31 @@ static void run_file(const char* path) {
 int main(int argc, const char* argv[]) {
   vm_init();
 
-  if (argc == 1) {
+  int arg = 1;
+
+  for (; arg < argc && argv[arg][0] == '-'; arg++) {
+    if (strcmp(argv[arg], "-O") == 0) {
+      optimize = true;
+    } else if (strcmp(argv[arg], "--compile") == 0) {
+      compile_only = true;
+    } else if (strcmp(argv[arg], "--no-cache") == 0) {
+      use_cache = false;
+    } else {
+      break;
+    }
+  }
+
+  if (argc == arg && !compile_only) {
     repl();
-  } else if (argc == 2) {
-    run_file(argv[1]);
+  } else if (argc == arg + 1) {
+    run_file(argv[arg]);
   } else {
-    fprintf(stderr, "Usage: wee [path]\n");
+    fprintf(stderr, "Usage: wee [-O] [--compile] [--no-cache] [path]\n");
     exit(EXIT_FAILURE);
   }
 
   vm_free();
+  image_unmap(&script_image);
+
   return 0;
 }
@@ -0,0 +1,191 @@
+#include "map.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "mem.h"
+#include "value.h"
+
+#define INDEX_EMPTY -1
+#define INDEX_REMOVED -2
+
+#define MAP_MIN_CAPACITY 8
+
+// The index never gets more than two thirds full, and every entry ever appended holds a slot.
+#define ENTRY_CAPACITY(index_capacity) ((index_capacity) / 3 * 2)
+
+void map_init(Map* map) {
+  map->len = 0;
+  map->entry_len = 0;
+  map->entry_capacity = 0;
+  map->index_capacity = 0;
+
+  map->entries = NULL;
+  map->index = NULL;
+}
+
+void map_free(Map* map) {
+  MEM_FREE_ARRAY(MapEntry, map->entries, map->entry_capacity);
+  MEM_FREE_ARRAY(int32_t, map->index, map->index_capacity);
+
+  map_init(map);
+}
+
+// Returns the index slot that points at `key`, or -1.
+static int find_slot(const Map* map, Value key, uint32_t hash) {
+  uint32_t mask = (uint32_t) map->index_capacity - 1;
+
+  for (uint32_t slot = hash & mask;; slot = (slot + 1) & mask) {
+    int32_t position = map->index[slot];
+
+    if (position == INDEX_EMPTY) {
+      return -1;
+    }
+
+    if (position != INDEX_REMOVED) {
+      const MapEntry* entry = &map->entries[position];
+
+      if (entry->hash == hash && value_is_equal(entry->key, key)) {
+        return (int) slot;
+      }
+    }
+  }
+}
+
+static int find_free_slot(const Map* map, uint32_t hash) {
+  uint32_t mask = (uint32_t) map->index_capacity - 1;
+  uint32_t slot = hash & mask;
+
+  while (map->index[slot] >= 0) {
+    slot = (slot + 1) & mask;
+  }
+
+  return (int) slot;
+}
+
+// Squeezes out removed entries, then sizes both arrays so the live ones take at most half of the
+// entry capacity, which shrinks a map that has mostly been emptied.
+static void rebuild(Map* map) {
+  int len = 0;
+
+  for (int i = 0; i < map->entry_len; i++) {
+    if (!map->entries[i].is_removed) {
+      map->entries[len++] = map->entries[i];
+    }
+  }
+
+  map->entry_len = len;
+
+  int index_capacity = MAP_MIN_CAPACITY;
+
+  while (ENTRY_CAPACITY(index_capacity) < len * 2) {
+    index_capacity *= 2;
+  }
+
+  int entry_capacity = ENTRY_CAPACITY(index_capacity);
+
+  map->entries = MEM_GROW_ARRAY(MapEntry, map->entries, map->entry_capacity, entry_capacity);
+  map->entry_capacity = entry_capacity;
+
+  MEM_FREE_ARRAY(int32_t, map->index, map->index_capacity);
+  map->index = NULL;
+  map->index_capacity = 0;
+
+  int32_t* index = MEM_ALLOC(int32_t, index_capacity);
+
+  for (int i = 0; i < index_capacity; i++) {
+    index[i] = INDEX_EMPTY;
+  }
+
+  map->index = index;
+  map->index_capacity = index_capacity;
+
+  for (int i = 0; i < len; i++) {
+    map->index[find_free_slot(map, map->entries[i].hash)] = i;
+  }
+}
+
+bool map_set(Map* map, Value key, Value value) {
+  uint32_t hash = value_hash(key);
+
+  if (map->len > 0) {
+    int slot = find_slot(map, key, hash);
+
+    if (slot != -1) {
+      map->entries[map->index[slot]].value = value;
+      return false;
+    }
+  }
+
+  if (map->entry_len == map->entry_capacity) {
+    rebuild(map);
+  }
+
+  int position = map->entry_len++;
+  MapEntry* entry = &map->entries[position];
+
+  entry->key = key;
+  entry->value = value;
+  entry->hash = hash;
+  entry->is_removed = false;
+
+  map->index[find_free_slot(map, hash)] = position;
+  map->len += 1;
+
+  return true;
+}
+
+bool map_get(Map* map, Value key, Value* dest) {
+  if (map->len == 0) {
+    return false;
+  }
+
+  int slot = find_slot(map, key, value_hash(key));
+
+  if (slot == -1) {
+    return false;
+  }
+
+  *dest = map->entries[map->index[slot]].value;
+  return true;
+}
+
+bool map_remove(Map* map, Value key) {
+  if (map->len == 0) {
+    return false;
+  }
+
+  int slot = find_slot(map, key, value_hash(key));
+
+  if (slot == -1) {
+    return false;
+  }
+
+  MapEntry* entry = &map->entries[map->index[slot]];
+
+  // Drop the references so the collector can reclaim them before the next rebuild.
+  entry->key = NIL_VAL;
+  entry->value = NIL_VAL;
+  entry->is_removed = true;
+
+  map->index[slot] = INDEX_REMOVED;
+  map->len -= 1;
+
+  return true;
+}
+
+// Walks the live entries in insertion order. Start with a zeroed cursor; the map must not be
+// modified during the walk.
+bool map_next(Map* map, int* cursor, Value* key, Value* value) {
+  while (*cursor < map->entry_len) {
+    const MapEntry* entry = &map->entries[(*cursor)++];
+
+    if (!entry->is_removed) {
+      *key = entry->key;
+      *value = entry->value;
+      return true;
+    }
+  }
+
+  return false;
+}
@@ -4,7 +4,9 @@
 #include <stdlib.h>
 
 #include "compiler.h"
+#include "map.h"
 #include "object.h"
+#include "string_set.h"
 #include "table.h"
 #include "value.h"
 #include "value_list.h"
@@ -17,11 +19,24 @@ static void mark_value(Value value);
 static void mark_object(Obj* object);
 
 static void mark_table(Table* table) {
-  for (int i = 0; i < table->capacity; i++) {
-    Entry* entry = &table->entries[i];
+  int cursor = 0;
+  ObjString* key;
+  Value value;
 
-    mark_object((Obj*) entry->key);
-    mark_value(entry->value);
+  while (table_next(table, &cursor, &key, &value)) {
+    mark_object((Obj*) key);
+    mark_value(value);
+  }
+}
+
+static void mark_map(Map* map) {
+  int cursor = 0;
+  Value key;
+  Value value;
+
+  while (map_next(map, &cursor, &key, &value)) {
+    mark_value(key);
+    mark_value(value);
   }
 }
 
@@ -71,16 +86,14 @@ static void mark_compiler_roots(void) {
 static void mark_roots(void) {
   for (Value* slot = vm.stack; slot < vm.stack_top; slot++) {
     mark_value(*slot);
+    mark_object((Obj*) vm.open_upvalues[slot - vm.stack]);
   }
 
   for (int i = 0; i < vm.frames_len; i++) {
+    mark_object((Obj*) vm.frames[i].function);
     mark_object((Obj*) vm.frames[i].closure);
   }
 
-  for (ObjUpvalue* upvalue = vm.open_upvalues; upvalue != NULL; upvalue = upvalue->next) {
-    mark_object((Obj*) upvalue);
-  }
-
   mark_table(&vm.globals);
   mark_compiler_roots();
   mark_object((Obj*) vm.init_string);
@@ -102,6 +115,7 @@ static void blacken_object(Obj* object) {
   switch (object->kind) {
     case OBJ_NATIVE_FN:
     case OBJ_STRING:
+    case OBJ_FLOAT64_ARRAY:
       break;
 
     case OBJ_UPVALUE:
@@ -111,6 +125,7 @@ static void blacken_object(Obj* object) {
     case OBJ_FUNCTION: {
       ObjFunction* function = (ObjFunction*) object;
       mark_object((Obj*) function->name);
+      mark_object((Obj*) function->field);
       mark_valuelist(&function->chunk.consts);
       break;
     }
@@ -130,12 +145,14 @@ static void blacken_object(Obj* object) {
       ObjClass* class = (ObjClass*) object;
       mark_object((Obj*) class->name);
       mark_table(&class->methods);
+      mark_object(class->initializer);
       break;
     }
 
     case OBJ_INSTANCE: {
       ObjInstance* instance = (ObjInstance*) object;
       mark_object((Obj*) instance->class);
+      mark_object((Obj*) instance->bound);
       mark_table(&instance->fields);
       break;
     }
@@ -146,6 +163,18 @@ static void blacken_object(Obj* object) {
       mark_object((Obj*) bound->method);
       break;
     }
+
+    case OBJ_LIST:
+      mark_valuelist(&((ObjList*) object)->items);
+      break;
+
+    case OBJ_MAP:
+      mark_map(&((ObjMap*) object)->map);
+      break;
+
+    case OBJ_SLICE:
+      mark_object((Obj*) ((ObjSlice*) object)->parent);
+      break;
   }
 }
 
@@ -181,16 +210,6 @@ static void sweep(void) {
   }
 }
 
-static void table_remove_unreachable(Table* table) {
-  for (int i = 0; i < table->capacity; i++) {
-    Entry* entry = &table->entries[i];
-
-    if (entry->key != NULL && !entry->key->obj.is_marked) {
-      table_remove(table, entry->key);
-    }
-  }
-}
-
 void* mem_realloc(void* ptr, size_t old_size, size_t new_size) {
   vm.bytes_allocated += new_size - old_size;
 
@@ -200,7 +219,7 @@ void* mem_realloc(void* ptr, size_t old_size, size_t new_size) {
   }
 #endif
 
-  if (vm.bytes_allocated > vm.gc_target) {
+  if (new_size > old_size && vm.bytes_allocated > vm.gc_target) {
     mem_collect();
   }
 
@@ -226,7 +245,7 @@ void mem_collect(void) {
 
   mark_roots();
   trace_references();
-  table_remove_unreachable(&vm.strings);
+  stringset_remove_unmarked(&vm.strings);
   sweep();
 
   vm.gc_target = vm.bytes_allocated * GC_HEAP_GROW_FACTOR;
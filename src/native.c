@@ -0,0 +1,646 @@
+#include "native.h"
+
+#include <ctype.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "float64.h"
+#include "map.h"
+#include "object.h"
+#include "text.h"
+#include "value.h"
+#include "value_list.h"
+#include "vm.h"
+
+static bool expect_list(Value value, const char* name) {
+  if (!IS_LIST(value)) {
+    runtime_error("%s() expects a list.", name);
+    return false;
+  }
+
+  return true;
+}
+
+static bool expect_text(Value value, const char* name) {
+  if (!IS_TEXT(value)) {
+    runtime_error("%s() expects a string.", name);
+    return false;
+  }
+
+  return true;
+}
+
+static bool expect_map(Value value, const char* name) {
+  if (!IS_MAP(value)) {
+    runtime_error("%s() expects a map.", name);
+    return false;
+  }
+
+  return true;
+}
+
+static bool expect_array(Value value, const char* name) {
+  if (!IS_FLOAT64_ARRAY(value)) {
+    runtime_error("%s() expects a float64 array.", name);
+    return false;
+  }
+
+  return true;
+}
+
+static bool expect_same_len(ObjFloat64Array* a, ObjFloat64Array* b, const char* name) {
+  if (a->len != b->len) {
+    runtime_error("%s() expects arrays of the same length, got %d and %d.", name, a->len, b->len);
+    return false;
+  }
+
+  return true;
+}
+
+static bool expect_number(Value value, const char* name) {
+  if (!IS_NUMERIC(value)) {
+    runtime_error("%s() expects a number.", name);
+    return false;
+  }
+
+  return true;
+}
+
+// Doubles with an integral value are accepted too.
+static bool expect_int(Value value, const char* name, int* dest) {
+  int64_t integer;
+
+  if (IS_INT(value)) {
+    integer = AS_INT(value);
+  } else if (!IS_NUMBER(value) || !value_as_int(AS_NUMBER(value), &integer)) {
+    runtime_error("%s() expects an integer.", name);
+    return false;
+  }
+
+  if (integer < INT_MIN || integer > INT_MAX) {
+    runtime_error("%s() expects an integer within 32 bits.", name);
+    return false;
+  }
+
+  *dest = (int) integer;
+  return true;
+}
+
+// Negative positions count from the end; the result is clamped to [0, len].
+static int clamp_position(int position, int len) {
+  if (position < 0) {
+    position += len;
+  }
+
+  return position < 0 ? 0 : (position > len ? len : position);
+}
+
+static bool native_clock(int arg_len, Value* args, Value* result) {
+  (void) arg_len;
+  (void) args;
+
+  *result = NUMBER_VAL((double) clock() / CLOCKS_PER_SEC);
+  return true;
+}
+
+static bool native_len(int arg_len, Value* args, Value* result) {
+  (void) arg_len;
+
+  if (IS_LIST(args[0])) {
+    *result = INT_VAL(AS_LIST(args[0])->items.len);
+  } else if (IS_TEXT(args[0])) {
+    *result = INT_VAL(text_len(args[0]));
+  } else if (IS_FLOAT64_ARRAY(args[0])) {
+    *result = INT_VAL(AS_FLOAT64_ARRAY(args[0])->len);
+  } else if (IS_MAP(args[0])) {
+    *result = INT_VAL(AS_MAP(args[0])->map.len);
+  } else {
+    runtime_error("len() expects a list, a string, a float64 array or a map.");
+    return false;
+  }
+
+  return true;
+}
+
+static bool native_push(int arg_len, Value* args, Value* result) {
+  (void) arg_len;
+  (void) result;
+
+  if (!expect_list(args[0], "push")) {
+    return false;
+  }
+
+  valuelist_write(&AS_LIST(args[0])->items, args[1]);
+  return true;
+}
+
+static bool native_pop(int arg_len, Value* args, Value* result) {
+  (void) arg_len;
+
+  if (!expect_list(args[0], "pop")) {
+    return false;
+  }
+
+  ValueList* items = &AS_LIST(args[0])->items;
+
+  if (items->len == 0) {
+    runtime_error("pop() from an empty list.");
+    return false;
+  }
+
+  items->len -= 1;
+  *result = items->values[items->len];
+  return true;
+}
+
+static bool native_slice(int arg_len, Value* args, Value* result) {
+  (void) arg_len;
+
+  int start;
+  int end;
+
+  if (!expect_list(args[0], "slice") || !expect_int(args[1], "slice", &start) ||
+      !expect_int(args[2], "slice", &end)) {
+    return false;
+  }
+
+  ValueList* items = &AS_LIST(args[0])->items;
+  start = clamp_position(start, items->len);
+  end = clamp_position(end, items->len);
+
+  ObjList* slice = list_new();
+  push(OBJ_VAL(slice));
+
+  for (int i = start; i < end; i++) {
+    valuelist_write(&slice->items, items->values[i]);
+  }
+
+  pop();
+
+  *result = OBJ_VAL(slice);
+  return true;
+}
+
+static int compare_values(const void* lhs, const void* rhs) {
+  Value a = *(const Value*) lhs;
+  Value b = *(const Value*) rhs;
+
+  if (IS_INT(a) && IS_INT(b)) {
+    return (AS_INT(a) > AS_INT(b)) - (AS_INT(a) < AS_INT(b));
+  }
+
+  if (IS_NUMERIC(a)) {
+    return (AS_FLOAT(a) > AS_FLOAT(b)) - (AS_FLOAT(a) < AS_FLOAT(b));
+  }
+
+  int a_len = text_len(a);
+  int b_len = text_len(b);
+
+  int cmp = memcmp(text_chars(a), text_chars(b), a_len < b_len ? a_len : b_len);
+  return cmp != 0 ? cmp : (a_len > b_len) - (a_len < b_len);
+}
+
+// Sorts in place; the elements must be all numbers or all strings.
+static bool native_sort(int arg_len, Value* args, Value* result) {
+  (void) arg_len;
+  (void) result;
+
+  if (!expect_list(args[0], "sort")) {
+    return false;
+  }
+
+  ValueList* items = &AS_LIST(args[0])->items;
+
+  if (items->len == 0) {
+    return true;
+  }
+
+  bool is_number = IS_NUMERIC(items->values[0]);
+
+  for (int i = 0; i < items->len; i++) {
+    Value item = items->values[i];
+
+    if (is_number ? !IS_NUMERIC(item) : !IS_TEXT(item)) {
+      runtime_error("sort() expects a list of only numbers or only strings.");
+      return false;
+    }
+  }
+
+  qsort(items->values, items->len, sizeof(Value), compare_values);
+  return true;
+}
+
+// Views `len` characters of a string or slice from `start`, always pointing at the underlying
+// string so slices of slices don't chain.
+static Value text_slice(Value text, int start, int len) {
+  if (IS_STRING(text) && start == 0 && len == AS_STRING(text)->len) {
+    return text;
+  }
+
+  if (IS_SLICE(text)) {
+    ObjSlice* slice = AS_SLICE(text);
+    return OBJ_VAL(slice_new(slice->parent, slice->start + start, len));
+  }
+
+  return OBJ_VAL(slice_new(AS_STRING(text), start, len));
+}
+
+static bool native_find(int arg_len, Value* args, Value* result) {
+  (void) arg_len;
+
+  if (!expect_text(args[0], "find") || !expect_text(args[1], "find")) {
+    return false;
+  }
+
+  int idx = text_find(text_chars(args[0]), text_len(args[0]), text_chars(args[1]),
+                      text_len(args[1]));
+
+  *result = INT_VAL(idx);
+  return true;
+}
+
+static bool native_split(int arg_len, Value* args, Value* result) {
+  (void) arg_len;
+
+  if (!expect_text(args[0], "split") || !expect_text(args[1], "split")) {
+    return false;
+  }
+
+  const char* chars = text_chars(args[0]);
+  int len = text_len(args[0]);
+  const char* separator = text_chars(args[1]);
+  int separator_len = text_len(args[1]);
+
+  if (separator_len == 0) {
+    runtime_error("split() expects a non-empty separator.");
+    return false;
+  }
+
+  ObjList* list = list_new();
+  push(OBJ_VAL(list));
+
+  int start = 0;
+
+  while (true) {
+    int idx = text_find(chars + start, len - start, separator, separator_len);
+    int end = idx == -1 ? len : start + idx;
+
+    // Allocating doesn't move anything, so `chars` stays valid.
+    Value piece = text_slice(args[0], start, end - start);
+    push(piece);
+    valuelist_write(&list->items, piece);
+    pop();
+
+    if (idx == -1) {
+      break;
+    }
+
+    start = end + separator_len;
+  }
+
+  pop();
+
+  *result = OBJ_VAL(list);
+  return true;
+}
+
+// Positions work as in slice(): negative ones count from the end and both are clamped.
+static bool native_substring(int arg_len, Value* args, Value* result) {
+  (void) arg_len;
+
+  int start;
+  int end;
+
+  if (!expect_text(args[0], "substring") || !expect_int(args[1], "substring", &start) ||
+      !expect_int(args[2], "substring", &end)) {
+    return false;
+  }
+
+  int len = text_len(args[0]);
+  start = clamp_position(start, len);
+  end = clamp_position(end, len);
+
+  *result = text_slice(args[0], start, end > start ? end - start : 0);
+  return true;
+}
+
+static bool native_starts_with(int arg_len, Value* args, Value* result) {
+  (void) arg_len;
+
+  if (!expect_text(args[0], "starts_with") || !expect_text(args[1], "starts_with")) {
+    return false;
+  }
+
+  int prefix_len = text_len(args[1]);
+
+  *result = BOOL_VAL(text_len(args[0]) >= prefix_len &&
+                     memcmp(text_chars(args[0]), text_chars(args[1]), prefix_len) == 0);
+  return true;
+}
+
+static bool native_trim(int arg_len, Value* args, Value* result) {
+  (void) arg_len;
+
+  if (!expect_text(args[0], "trim")) {
+    return false;
+  }
+
+  const char* chars = text_chars(args[0]);
+  int start = 0;
+  int end = text_len(args[0]);
+
+  while (start < end && isspace((unsigned char) chars[start])) {
+    start++;
+  }
+
+  while (end > start && isspace((unsigned char) chars[end - 1])) {
+    end--;
+  }
+
+  *result = text_slice(args[0], start, end - start);
+  return true;
+}
+
+// Turns a slice into an interned string that no longer keeps its parent alive.
+static bool native_intern(int arg_len, Value* args, Value* result) {
+  (void) arg_len;
+
+  if (!expect_text(args[0], "intern")) {
+    return false;
+  }
+
+  if (IS_STRING(args[0])) {
+    *result = args[0];
+  } else {
+    *result = OBJ_VAL(string_copy(text_chars(args[0]), text_len(args[0])));
+  }
+
+  return true;
+}
+
+// Collects the keys or the values of a map into a new list, in insertion order.
+static bool map_collect(Value* args, Value* result, const char* name, bool want_keys) {
+  if (!expect_map(args[0], name)) {
+    return false;
+  }
+
+  Map* map = &AS_MAP(args[0])->map;
+  ObjList* list = list_new();
+  push(OBJ_VAL(list));
+
+  int cursor = 0;
+  Value key;
+  Value value;
+
+  while (map_next(map, &cursor, &key, &value)) {
+    valuelist_write(&list->items, want_keys ? key : value);
+  }
+
+  pop();
+
+  *result = OBJ_VAL(list);
+  return true;
+}
+
+static bool native_keys(int arg_len, Value* args, Value* result) {
+  (void) arg_len;
+  return map_collect(args, result, "keys", true);
+}
+
+static bool native_values(int arg_len, Value* args, Value* result) {
+  (void) arg_len;
+  return map_collect(args, result, "values", false);
+}
+
+static bool native_has(int arg_len, Value* args, Value* result) {
+  (void) arg_len;
+
+  if (!expect_map(args[0], "has")) {
+    return false;
+  }
+
+  Value value;
+
+  *result = BOOL_VAL(map_get(&AS_MAP(args[0])->map, args[1], &value));
+  return true;
+}
+
+// Returns whether the key was present.
+static bool native_remove(int arg_len, Value* args, Value* result) {
+  (void) arg_len;
+
+  if (!expect_map(args[0], "remove")) {
+    return false;
+  }
+
+  *result = BOOL_VAL(map_remove(&AS_MAP(args[0])->map, args[1]));
+  return true;
+}
+
+// Builds a zeroed array from a length, or a copy of a list of numbers.
+static bool native_float64array(int arg_len, Value* args, Value* result) {
+  (void) arg_len;
+
+  if (IS_LIST(args[0])) {
+    ValueList* items = &AS_LIST(args[0])->items;
+
+    for (int i = 0; i < items->len; i++) {
+      if (!IS_NUMERIC(items->values[i])) {
+        runtime_error("float64array() expects a list of only numbers.");
+        return false;
+      }
+    }
+
+    ObjFloat64Array* array = float64array_new(items->len);
+
+    for (int i = 0; i < items->len; i++) {
+      array->values[i] = AS_FLOAT(items->values[i]);
+    }
+
+    *result = OBJ_VAL(array);
+    return true;
+  }
+
+  int len;
+
+  if (!expect_int(args[0], "float64array", &len)) {
+    return false;
+  }
+
+  if (len < 0) {
+    runtime_error("float64array() expects a non-negative length.");
+    return false;
+  }
+
+  *result = OBJ_VAL(float64array_new(len));
+  return true;
+}
+
+static bool native_f64_sum(int arg_len, Value* args, Value* result) {
+  (void) arg_len;
+
+  if (!expect_array(args[0], "f64_sum")) {
+    return false;
+  }
+
+  ObjFloat64Array* array = AS_FLOAT64_ARRAY(args[0]);
+
+  *result = NUMBER_VAL(float64_sum(array->values, array->len));
+  return true;
+}
+
+static bool native_f64_dot(int arg_len, Value* args, Value* result) {
+  (void) arg_len;
+
+  if (!expect_array(args[0], "f64_dot") || !expect_array(args[1], "f64_dot")) {
+    return false;
+  }
+
+  ObjFloat64Array* a = AS_FLOAT64_ARRAY(args[0]);
+  ObjFloat64Array* b = AS_FLOAT64_ARRAY(args[1]);
+
+  if (!expect_same_len(a, b, "f64_dot")) {
+    return false;
+  }
+
+  *result = NUMBER_VAL(float64_dot(a->values, b->values, a->len));
+  return true;
+}
+
+static bool native_f64_min(int arg_len, Value* args, Value* result) {
+  (void) arg_len;
+
+  if (!expect_array(args[0], "f64_min")) {
+    return false;
+  }
+
+  ObjFloat64Array* array = AS_FLOAT64_ARRAY(args[0]);
+
+  if (array->len == 0) {
+    runtime_error("f64_min() of an empty array.");
+    return false;
+  }
+
+  *result = NUMBER_VAL(float64_min(array->values, array->len));
+  return true;
+}
+
+static bool native_f64_max(int arg_len, Value* args, Value* result) {
+  (void) arg_len;
+
+  if (!expect_array(args[0], "f64_max")) {
+    return false;
+  }
+
+  ObjFloat64Array* array = AS_FLOAT64_ARRAY(args[0]);
+
+  if (array->len == 0) {
+    runtime_error("f64_max() of an empty array.");
+    return false;
+  }
+
+  *result = NUMBER_VAL(float64_max(array->values, array->len));
+  return true;
+}
+
+// f64_axpy(alpha, x, y) computes y += alpha * x in place.
+static bool native_f64_axpy(int arg_len, Value* args, Value* result) {
+  (void) arg_len;
+  (void) result;
+
+  if (!expect_number(args[0], "f64_axpy") || !expect_array(args[1], "f64_axpy") ||
+      !expect_array(args[2], "f64_axpy")) {
+    return false;
+  }
+
+  ObjFloat64Array* x = AS_FLOAT64_ARRAY(args[1]);
+  ObjFloat64Array* y = AS_FLOAT64_ARRAY(args[2]);
+
+  if (!expect_same_len(x, y, "f64_axpy")) {
+    return false;
+  }
+
+  float64_axpy(AS_FLOAT(args[0]), x->values, y->values, x->len);
+  return true;
+}
+
+static bool native_f64_scale(int arg_len, Value* args, Value* result) {
+  (void) arg_len;
+  (void) result;
+
+  if (!expect_array(args[0], "f64_scale") || !expect_number(args[1], "f64_scale")) {
+    return false;
+  }
+
+  ObjFloat64Array* array = AS_FLOAT64_ARRAY(args[0]);
+
+  float64_scale(array->values, AS_FLOAT(args[1]), array->len);
+  return true;
+}
+
+static bool float64_binary(Value* args, Value* result, const char* name,
+                           void (*kernel)(const double*, const double*, double*, int)) {
+  if (!expect_array(args[0], name) || !expect_array(args[1], name)) {
+    return false;
+  }
+
+  ObjFloat64Array* a = AS_FLOAT64_ARRAY(args[0]);
+  ObjFloat64Array* b = AS_FLOAT64_ARRAY(args[1]);
+
+  if (!expect_same_len(a, b, name)) {
+    return false;
+  }
+
+  // Allocating may collect, but both operands are still on the stack as arguments.
+  ObjFloat64Array* dest = float64array_new(a->len);
+  kernel(a->values, b->values, dest->values, a->len);
+
+  *result = OBJ_VAL(dest);
+  return true;
+}
+
+static bool native_f64_add(int arg_len, Value* args, Value* result) {
+  (void) arg_len;
+  return float64_binary(args, result, "f64_add", float64_add);
+}
+
+static bool native_f64_mul(int arg_len, Value* args, Value* result) {
+  (void) arg_len;
+  return float64_binary(args, result, "f64_mul", float64_mul);
+}
+
+void natives_define(void) {
+  define_native("clock", 0, native_clock);
+
+  define_native("len", 1, native_len);
+  define_native("push", 2, native_push);
+  define_native("pop", 1, native_pop);
+  define_native("slice", 3, native_slice);
+  define_native("sort", 1, native_sort);
+
+  define_native("find", 2, native_find);
+  define_native("split", 2, native_split);
+  define_native("substring", 3, native_substring);
+  define_native("starts_with", 2, native_starts_with);
+  define_native("trim", 1, native_trim);
+  define_native("intern", 1, native_intern);
+
+  define_native("keys", 1, native_keys);
+  define_native("values", 1, native_values);
+  define_native("has", 2, native_has);
+  define_native("remove", 2, native_remove);
+
+  define_native("float64array", 1, native_float64array);
+  define_native("f64_sum", 1, native_f64_sum);
+  define_native("f64_dot", 2, native_f64_dot);
+  define_native("f64_min", 1, native_f64_min);
+  define_native("f64_max", 1, native_f64_max);
+  define_native("f64_axpy", 3, native_f64_axpy);
+  define_native("f64_scale", 2, native_f64_scale);
+  define_native("f64_add", 2, native_f64_add);
+  define_native("f64_mul", 2, native_f64_mul);
+}
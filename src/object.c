@@ -6,12 +6,27 @@
 #include <string.h>
 
 #include "chunk.h"
+#include "hash.h"
+#include "map.h"
 #include "mem.h"
+#include "string_set.h"
 #include "table.h"
 #include "value.h"
+#include "value_list.h"
 #include "vm.h"
 
 #define ALLOC_OBJ(type, kind) (type*) object_alloc(sizeof(type), kind)
+#define STRING_SIZE(len) (sizeof(ObjString) + (size_t) (len) + 1)
+#define CLOSURE_SIZE(len, stack_len)                           \
+  (sizeof(ObjClosure) + sizeof(ObjUpvalue*) * (size_t) (len) + \
+   sizeof(ObjUpvalue) * (size_t) (stack_len))
+#define FLOAT64_ARRAY_SIZE(len) (sizeof(ObjFloat64Array) + sizeof(double) * (size_t) (len))
+
+// The characters of a borrowed string belong to the image, so only the pointer to them is part of
+// its allocation.
+static inline size_t string_size(ObjString* string) {
+  return string->is_borrowed ? sizeof(ObjString) + sizeof(const char*) : STRING_SIZE(string->len);
+}
 
 static Obj* object_alloc(size_t size, ObjKind kind) {
   Obj* object = (Obj*) mem_realloc(NULL, 0, size);
@@ -28,50 +43,15 @@ static Obj* object_alloc(size_t size, ObjKind kind) {
   return object;
 }
 
-static uint32_t hash_fnv1a(const char* chars, int len) {
-  uint32_t hash = 2166136261U;
-
-  for (int i = 0; i < len; i++) {
-    hash ^= (uint8_t) chars[i];
-    hash *= 16777619;
-  }
-
-  return hash;
-}
-
-static ObjString* strings_find(const char* chars, int len, uint32_t hash) {
-  if (vm.strings.len == 0) {
-    return NULL;
-  }
-
-  uint32_t idx = hash & (vm.strings.capacity - 1);
-  while (true) {
-    Entry* entry = &vm.strings.entries[idx];
-    if (entry->key == NULL) {
-      if (IS_NIL(entry->value)) {
-        return NULL;
-      }
-    } else if (entry->key->len == len && entry->key->hash == hash &&
-               memcmp(entry->key->chars, chars, len) == 0) {
-      return entry->key;
-    }
-
-    idx = (idx + 1) & (vm.strings.capacity - 1);
-  }
-}
-
 void object_free(Obj* object) {
 #ifdef LOG_GC
   printf("-- %p free type %d\n", (void*) object, object->kind);
 #endif
 
   switch (object->kind) {
-    case OBJ_STRING: {
-      ObjString* string = (ObjString*) object;
-      MEM_FREE_ARRAY(char, string->chars, string->len + 1);
-      MEM_FREE(ObjString, object);
+    case OBJ_STRING:
+      mem_realloc(object, string_size((ObjString*) object), 0);
       break;
-    }
 
     case OBJ_FUNCTION: {
       ObjFunction* function = (ObjFunction*) object;
@@ -84,11 +64,11 @@ void object_free(Obj* object) {
       MEM_FREE(ObjNativeFn, object);
       break;
 
-    case OBJ_CLOSURE:
-      MEM_FREE_ARRAY(ObjUpvalue*, ((ObjClosure*) object)->upvalues,
-                     ((ObjClosure*) object)->upvalue_len);
-      MEM_FREE(ObjClosure, object);
+    case OBJ_CLOSURE: {
+      ObjClosure* closure = (ObjClosure*) object;
+      mem_realloc(object, CLOSURE_SIZE(closure->upvalue_len, closure->stack_upvalue_len), 0);
       break;
+    }
 
     case OBJ_UPVALUE:
       MEM_FREE(ObjUpvalue, object);
@@ -109,36 +89,114 @@ void object_free(Obj* object) {
     case OBJ_BOUND_METHOD:
       MEM_FREE(ObjBoundMethod, object);
       break;
-  }
-}
 
-ObjString* string_new(const char* chars, int len) {
-  uint32_t hash = hash_fnv1a(chars, len);
-  ObjString* string = strings_find(chars, len, hash);
+    case OBJ_LIST:
+      valuelist_free(&((ObjList*) object)->items);
+      MEM_FREE(ObjList, object);
+      break;
 
-  if (string != NULL) {
-    MEM_FREE_ARRAY(char, chars, len);
-    return string;
+    case OBJ_FLOAT64_ARRAY:
+      mem_realloc(object, FLOAT64_ARRAY_SIZE(((ObjFloat64Array*) object)->len), 0);
+      break;
+
+    case OBJ_MAP:
+      map_free(&((ObjMap*) object)->map);
+      MEM_FREE(ObjMap, object);
+      break;
+
+    case OBJ_SLICE:
+      MEM_FREE(ObjSlice, object);
+      break;
   }
+}
 
-  string = ALLOC_OBJ(ObjString, OBJ_STRING);
+static ObjString* string_alloc(int len) {
+  ObjString* string = (ObjString*) mem_realloc(NULL, 0, STRING_SIZE(len));
 
+  string->obj.kind = OBJ_STRING;
+  string->obj.is_marked = false;
+  string->obj.next = NULL;
   string->len = len;
-  string->chars = chars;
-  string->hash = hash;
+  string->is_borrowed = false;
+  string->chars[len] = '\0';
+
+  return string;
+}
+
+// Links a freshly built string into the heap and the intern table.
+static ObjString* string_intern(ObjString* string) {
+  string->obj.next = vm.objects;
+  vm.objects = (Obj*) string;
+
+#ifdef LOG_GC
+  printf("-- %p allocated %zu for %d\n", (void*) string, string_size(string), OBJ_STRING);
+#endif
 
   push(OBJ_VAL(string));
-  table_set(&vm.strings, string, NIL_VAL);
+  stringset_add(&vm.strings, string);
   pop();
 
   return string;
 }
 
 ObjString* string_copy(const char* chars, int len) {
-  char* ptr = MEM_ALLOC(char, len + 1);
-  memcpy(ptr, chars, len);
-  ptr[len] = '\0';
-  return string_new(ptr, len);
+  uint32_t hash = hash_string(chars, len);
+  ObjString* string = stringset_find(&vm.strings, chars, len, "", 0, hash);
+
+  if (string != NULL) {
+    return string;
+  }
+
+  string = string_alloc(len);
+  memcpy(string->chars, chars, len);
+  string->hash = hash;
+
+  return string_intern(string);
+}
+
+// The pieces may point into other strings, which the caller keeps reachable.
+ObjString* string_concat(const char* a, int a_len, const char* b, int b_len) {
+  Hasher hasher;
+
+  hasher_init(&hasher);
+  hasher_update(&hasher, a, a_len);
+  hasher_update(&hasher, b, b_len);
+
+  uint32_t hash = hash_fold(hasher_finish(&hasher));
+  ObjString* string = stringset_find(&vm.strings, a, a_len, b, b_len, hash);
+
+  if (string != NULL) {
+    return string;
+  }
+
+  string = string_alloc(a_len + b_len);
+  memcpy(string->chars, a, a_len);
+  memcpy(string->chars + a_len, b, b_len);
+  string->hash = hash;
+
+  return string_intern(string);
+}
+
+// Like string_copy(), but a new string points at `chars`, which must end in a NUL and outlive it.
+ObjString* string_borrow(const char* chars, int len) {
+  uint32_t hash = hash_string(chars, len);
+  ObjString* string = stringset_find(&vm.strings, chars, len, "", 0, hash);
+
+  if (string != NULL) {
+    return string;
+  }
+
+  string = (ObjString*) mem_realloc(NULL, 0, sizeof(ObjString) + sizeof(chars));
+
+  string->obj.kind = OBJ_STRING;
+  string->obj.is_marked = false;
+  string->obj.next = NULL;
+  string->len = len;
+  string->hash = hash;
+  string->is_borrowed = true;
+  memcpy(string->chars, &chars, sizeof(chars));
+
+  return string_intern(string);
 }
 
 ObjFunction* function_new(void) {
@@ -147,30 +205,44 @@ ObjFunction* function_new(void) {
   function->arity = 0;
   function->name = NULL;
   function->upvalue_len = 0;
+  function->field = NULL;
+  function->max_stack = 0;
 
   chunk_init(&function->chunk);
 
   return function;
 }
 
-ObjNativeFn* native_new(NativeFn function) {
+ObjNativeFn* native_new(NativeFn function, int arity) {
   ObjNativeFn* native = ALLOC_OBJ(ObjNativeFn, OBJ_NATIVE_FN);
+
+  native->arity = arity;
   native->function = function;
+
   return native;
 }
 
-ObjClosure* closure_new(ObjFunction* function) {
-  ObjUpvalue** upvalues = MEM_ALLOC(ObjUpvalue*, function->upvalue_len);
+ObjClosure* closure_new(ObjFunction* function, int stack_upvalue_len) {
+  ObjClosure* closure = (ObjClosure*) object_alloc(
+      CLOSURE_SIZE(function->upvalue_len, stack_upvalue_len), OBJ_CLOSURE);
+
+  closure->function = function;
+  closure->upvalue_len = function->upvalue_len;
+  closure->stack_upvalue_len = stack_upvalue_len;
 
   for (int i = 0; i < function->upvalue_len; i++) {
-    upvalues[i] = NULL;
+    closure->upvalues[i] = NULL;
   }
 
-  ObjClosure* closure = ALLOC_OBJ(ObjClosure, OBJ_CLOSURE);
+  ObjUpvalue* stack_upvalues = CLOSURE_STACK_UPVALUES(closure);
 
-  closure->function = function;
-  closure->upvalues = upvalues;
-  closure->upvalue_len = function->upvalue_len;
+  for (int i = 0; i < stack_upvalue_len; i++) {
+    stack_upvalues[i].obj.kind = OBJ_UPVALUE;
+    stack_upvalues[i].obj.is_marked = true;
+    stack_upvalues[i].obj.next = NULL;
+    stack_upvalues[i].ptr = NULL;
+    stack_upvalues[i].closed = NIL_VAL;
+  }
 
   return closure;
 }
@@ -179,7 +251,6 @@ ObjUpvalue* upvalue_new(Value* slot) {
   ObjUpvalue* upvalue = ALLOC_OBJ(ObjUpvalue, OBJ_UPVALUE);
 
   upvalue->ptr = slot;
-  upvalue->next = NULL;
   upvalue->closed = NIL_VAL;
 
   return upvalue;
@@ -190,6 +261,8 @@ ObjClass* class_new(ObjString* name) {
 
   class->name = name;
   table_init(&class->methods);
+  class->initializer = NULL;
+  class->field_len = 0;
 
   return class;
 }
@@ -198,12 +271,13 @@ ObjInstance* instance_new(ObjClass* class) {
   ObjInstance* instance = ALLOC_OBJ(ObjInstance, OBJ_INSTANCE);
 
   instance->class = class;
+  instance->bound = NULL;
   table_init(&instance->fields);
 
   return instance;
 }
 
-ObjBoundMethod* boundmethod_new(Value receiver, ObjClosure* method) {
+ObjBoundMethod* boundmethod_new(Value receiver, Obj* method) {
   ObjBoundMethod* bound = ALLOC_OBJ(ObjBoundMethod, OBJ_BOUND_METHOD);
 
   bound->receiver = receiver;
@@ -211,3 +285,35 @@ ObjBoundMethod* boundmethod_new(Value receiver, ObjClosure* method) {
 
   return bound;
 }
+
+ObjList* list_new(void) {
+  ObjList* list = ALLOC_OBJ(ObjList, OBJ_LIST);
+  valuelist_init(&list->items);
+  return list;
+}
+
+ObjMap* map_new(void) {
+  ObjMap* map = ALLOC_OBJ(ObjMap, OBJ_MAP);
+  map_init(&map->map);
+  return map;
+}
+
+ObjSlice* slice_new(ObjString* parent, int start, int len) {
+  ObjSlice* slice = ALLOC_OBJ(ObjSlice, OBJ_SLICE);
+
+  slice->parent = parent;
+  slice->start = start;
+  slice->len = len;
+
+  return slice;
+}
+
+ObjFloat64Array* float64array_new(int len) {
+  ObjFloat64Array* array =
+      (ObjFloat64Array*) object_alloc(FLOAT64_ARRAY_SIZE(len), OBJ_FLOAT64_ARRAY);
+
+  array->len = len;
+  memset(array->values, 0, sizeof(double) * (size_t) len);
+
+  return array;
+}
@@ -0,0 +1,200 @@
+#include "op.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+OpShape op_shape(uint8_t op) {
+  switch (op) {
+    case OP_LOAD:
+    case OP_DEFINE_GLOBAL:
+    case OP_GET_GLOBAL:
+    case OP_SET_GLOBAL:
+    case OP_GET_LOCAL:
+    case OP_SET_LOCAL:
+    case OP_CALL:
+    case OP_GET_UPVALUE:
+    case OP_SET_UPVALUE:
+    case OP_CLASS:
+    case OP_GET_PROPERTY:
+    case OP_SET_PROPERTY:
+    case OP_METHOD:
+    case OP_GET_SUPER:
+    case OP_LIST:
+    case OP_MAP:
+    case OP_CHECK_INT:
+    case OP_CHECK_FLOAT:
+      return SHAPE_BYTE;
+
+    case OP_INC_LOCAL:
+    case OP_INVOKE:
+    case OP_SUPER_INVOKE:
+      return SHAPE_TWO_BYTES;
+
+    case OP_JUMP:
+    case OP_JUMP_BACK:
+    case OP_JUMP_IF_TRUE_OR_POP:
+    case OP_JUMP_IF_FALSE_OR_POP:
+    case OP_POP_JUMP_IF_FALSE:
+    case OP_JUMP_UNLESS_LESSER:
+    case OP_JUMP_UNLESS_GREATER:
+    case OP_JUMP_UNLESS_LESSER_EQUAL:
+    case OP_JUMP_UNLESS_GREATER_EQUAL:
+    case OP_JUMP_UNLESS_EQUAL:
+    case OP_JUMP_UNLESS_NOT_EQUAL:
+    case OP_JUMP_UNLESS_LESSER_INT:
+    case OP_JUMP_UNLESS_GREATER_INT:
+    case OP_JUMP_UNLESS_LESSER_EQUAL_INT:
+    case OP_JUMP_UNLESS_GREATER_EQUAL_INT:
+    case OP_JUMP_UNLESS_LESSER_NUM:
+    case OP_JUMP_UNLESS_GREATER_NUM:
+    case OP_JUMP_UNLESS_LESSER_EQUAL_NUM:
+    case OP_JUMP_UNLESS_GREATER_EQUAL_NUM:
+      return SHAPE_JUMP;
+
+    case OP_FOR_PREP:
+    case OP_FOR_LOOP:
+      return SHAPE_SLOT_JUMP;
+
+    case OP_JUMP_UNLESS_CALLEE:
+      return SHAPE_GUARD;
+
+    case OP_CLOSURE:
+      return SHAPE_CLOSURE;
+
+    default:
+      return SHAPE_NONE;
+  }
+}
+
+bool op_stack_effect(uint8_t op, uint8_t arg, uint8_t arg2, int* pops, int* pushes) {
+  *pops = 0;
+  *pushes = 0;
+
+  switch (op) {
+    case OP_LOAD:
+    case OP_NIL:
+    case OP_TRUE:
+    case OP_FALSE:
+    case OP_DUP:
+    case OP_GET_GLOBAL:
+    case OP_GET_LOCAL:
+    case OP_GET_UPVALUE:
+    case OP_CLOSURE:
+    case OP_CLASS:
+      *pushes = 1;
+      return true;
+
+    case OP_NEGATE:
+    case OP_NOT:
+    case OP_BIT_NOT:
+    case OP_GET_PROPERTY:
+      *pops = 1;
+      *pushes = 1;
+      return true;
+
+    case OP_ADD:
+    case OP_SUBTRACT:
+    case OP_MULTIPLY:
+    case OP_DIVIDE:
+    case OP_MODULO:
+    case OP_BIT_AND:
+    case OP_BIT_OR:
+    case OP_BIT_XOR:
+    case OP_SHIFT_LEFT:
+    case OP_SHIFT_RIGHT:
+    case OP_LESSER:
+    case OP_GREATER:
+    case OP_LESSER_EQUAL:
+    case OP_GREATER_EQUAL:
+    case OP_EQUAL:
+    case OP_NOT_EQUAL:
+    case OP_SET_PROPERTY:
+    case OP_GET_SUPER:
+    case OP_INDEX_GET:
+    case OP_ADD_INT:
+    case OP_SUBTRACT_INT:
+    case OP_MULTIPLY_INT:
+    case OP_LESSER_INT:
+    case OP_GREATER_INT:
+    case OP_LESSER_EQUAL_INT:
+    case OP_GREATER_EQUAL_INT:
+    case OP_ADD_NUM:
+    case OP_SUBTRACT_NUM:
+    case OP_MULTIPLY_NUM:
+    case OP_LESSER_NUM:
+    case OP_GREATER_NUM:
+    case OP_LESSER_EQUAL_NUM:
+    case OP_GREATER_EQUAL_NUM:
+      *pops = 2;
+      *pushes = 1;
+      return true;
+
+    case OP_INDEX_SET:
+      *pops = 3;
+      *pushes = 1;
+      return true;
+
+    case OP_RETURN:
+    case OP_POP:
+    case OP_PRINT:
+    case OP_DEFINE_GLOBAL:
+    case OP_CLOSE_UPVALUE:
+    case OP_METHOD:
+    case OP_INHERIT:
+    case OP_JUMP_IF_TRUE_OR_POP:
+    case OP_JUMP_IF_FALSE_OR_POP:
+    case OP_POP_JUMP_IF_FALSE:
+      *pops = 1;
+      return true;
+
+    case OP_JUMP_UNLESS_LESSER:
+    case OP_JUMP_UNLESS_GREATER:
+    case OP_JUMP_UNLESS_LESSER_EQUAL:
+    case OP_JUMP_UNLESS_GREATER_EQUAL:
+    case OP_JUMP_UNLESS_EQUAL:
+    case OP_JUMP_UNLESS_NOT_EQUAL:
+    case OP_JUMP_UNLESS_LESSER_INT:
+    case OP_JUMP_UNLESS_GREATER_INT:
+    case OP_JUMP_UNLESS_LESSER_EQUAL_INT:
+    case OP_JUMP_UNLESS_GREATER_EQUAL_INT:
+    case OP_JUMP_UNLESS_LESSER_NUM:
+    case OP_JUMP_UNLESS_GREATER_NUM:
+    case OP_JUMP_UNLESS_LESSER_EQUAL_NUM:
+    case OP_JUMP_UNLESS_GREATER_EQUAL_NUM:
+      *pops = 2;
+      return true;
+
+    case OP_SET_GLOBAL:
+    case OP_SET_LOCAL:
+    case OP_SET_UPVALUE:
+    case OP_INC_LOCAL:
+    case OP_JUMP:
+    case OP_JUMP_BACK:
+    case OP_FOR_PREP:
+    case OP_FOR_LOOP:
+    case OP_JUMP_UNLESS_CALLEE:
+    case OP_CHECK_INT:
+    case OP_CHECK_FLOAT:
+      return true;
+
+    case OP_CALL:
+    case OP_LIST:
+      *pops = arg + (op == OP_CALL);
+      *pushes = 1;
+      return true;
+
+    case OP_MAP:
+      *pops = 2 * arg;
+      *pushes = 1;
+      return true;
+
+    case OP_INVOKE:
+    case OP_SUPER_INVOKE:
+      *pops = arg2 + (op == OP_INVOKE ? 1 : 2);
+      *pushes = 1;
+      return true;
+
+    default:
+      return false;
+  }
+}
@@ -0,0 +1,138 @@
+#include "string_set.h"
+
+#include <stdint.h>
+#include <string.h>
+
+#include "mem.h"
+#include "object.h"
+
+#define STRING_SET_MAX_LOAD 0.75
+
+// Slot states live in the hash array; live hashes that collide with them are remapped.
+#define SLOT_EMPTY 0
+#define SLOT_TOMBSTONE 1
+#define STORED_HASH(hash) ((hash) <= SLOT_TOMBSTONE ? (hash) + 2 : (hash))
+
+void stringset_init(StringSet* set) {
+  set->len = 0;
+  set->used = 0;
+  set->capacity = 0;
+  set->hashes = NULL;
+  set->keys = NULL;
+}
+
+void stringset_free(StringSet* set) {
+  MEM_FREE_ARRAY(uint32_t, set->hashes, set->capacity);
+  MEM_FREE_ARRAY(ObjString*, set->keys, set->capacity);
+  stringset_init(set);
+}
+
+ObjString* stringset_find(StringSet* set, const char* prefix, int prefix_len, const char* suffix,
+                          int suffix_len, uint32_t hash) {
+  if (set->len == 0) {
+    return NULL;
+  }
+
+  int len = prefix_len + suffix_len;
+  uint32_t stored = STORED_HASH(hash);
+  uint32_t mask = set->capacity - 1;
+
+  for (uint32_t idx = hash & mask;; idx = (idx + 1) & mask) {
+    uint32_t slot = set->hashes[idx];
+
+    if (slot == SLOT_EMPTY) {
+      return NULL;
+    }
+
+    if (slot == stored) {
+      ObjString* key = set->keys[idx];
+      const char* chars = string_chars(key);
+
+      if (key->len == len && memcmp(chars, prefix, prefix_len) == 0 &&
+          memcmp(chars + prefix_len, suffix, suffix_len) == 0) {
+        return key;
+      }
+    }
+  }
+}
+
+static void insert_slot(uint32_t* hashes, ObjString** keys, int capacity, ObjString* string) {
+  uint32_t mask = capacity - 1;
+  uint32_t idx = string->hash & mask;
+
+  while (hashes[idx] > SLOT_TOMBSTONE) {
+    idx = (idx + 1) & mask;
+  }
+
+  hashes[idx] = STORED_HASH(string->hash);
+  keys[idx] = string;
+}
+
+// Rehashes the live strings into fresh arrays, dropping every tombstone.
+static void rebuild(StringSet* set, int capacity) {
+  uint32_t* hashes = MEM_ALLOC(uint32_t, capacity);
+  ObjString** keys = MEM_ALLOC(ObjString*, capacity);
+
+  memset(hashes, 0, sizeof(uint32_t) * capacity);
+
+  for (int i = 0; i < set->capacity; i++) {
+    if (set->hashes[i] > SLOT_TOMBSTONE) {
+      insert_slot(hashes, keys, capacity, set->keys[i]);
+    }
+  }
+
+  MEM_FREE_ARRAY(uint32_t, set->hashes, set->capacity);
+  MEM_FREE_ARRAY(ObjString*, set->keys, set->capacity);
+
+  set->used = set->len;
+  set->capacity = capacity;
+  set->hashes = hashes;
+  set->keys = keys;
+}
+
+// Capacity that leaves `len` strings at between 1/8 and 1/2 of the maximum load.
+static int fitting_capacity(int capacity, int len) {
+  capacity = capacity < MEM_GROW_CAPACITY(0) ? MEM_GROW_CAPACITY(0) : capacity;
+
+  while (len > capacity * STRING_SET_MAX_LOAD / 2) {
+    capacity *= 2;
+  }
+
+  while (capacity > MEM_GROW_CAPACITY(0) && len <= capacity * STRING_SET_MAX_LOAD / 8) {
+    capacity /= 2;
+  }
+
+  return capacity;
+}
+
+void stringset_add(StringSet* set, ObjString* string) {
+  // Tombstones count towards the load, so sets emptied by the collector get compacted (and
+  // shrunk) here rather than during the collection itself, which must not allocate.
+  if (set->used + 1 > set->capacity * STRING_SET_MAX_LOAD) {
+    rebuild(set, fitting_capacity(set->capacity, set->len + 1));
+  }
+
+  uint32_t mask = set->capacity - 1;
+  uint32_t idx = string->hash & mask;
+
+  while (set->hashes[idx] > SLOT_TOMBSTONE) {
+    idx = (idx + 1) & mask;
+  }
+
+  if (set->hashes[idx] == SLOT_EMPTY) {
+    set->used += 1;
+  }
+
+  set->hashes[idx] = STORED_HASH(string->hash);
+  set->keys[idx] = string;
+  set->len += 1;
+}
+
+void stringset_remove_unmarked(StringSet* set) {
+  for (int i = 0; i < set->capacity; i++) {
+    if (set->hashes[i] > SLOT_TOMBSTONE && !set->keys[i]->obj.is_marked) {
+      set->hashes[i] = SLOT_TOMBSTONE;
+      set->len -= 1;
+    }
+  }
+}
@@ -7,87 +7,300 @@
 #include "mem.h"
 #include "object.h"
 
-#define TABLE_MAX_LOAD 0.75
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#define CTRL_EMPTY ((int8_t) -128)
+#define CTRL_DELETED ((int8_t) -2)
+
+#define HASH_TAG(hash) ((int8_t) ((hash) & 0x7F))
+#define HASH_GROUP(hash) ((hash) >> 7)
+
+#define TABLE_MIN_CAPACITY 8
+
+// Tables with fewer slots than this are still rehashed in one go.
+#define INCREMENTAL_MIN_CAPACITY 1024
+#define MIGRATE_STEP TABLE_GROUP_WIDTH
+
+// Tables never fill more than 7/8 of their slots.
+#define MAX_GROWTH(capacity) ((capacity) - (capacity) / 8)
+
+// Small tables still get a whole group of control bytes; the tail stays empty.
+#define CTRL_LEN(capacity) ((capacity) < TABLE_GROUP_WIDTH ? TABLE_GROUP_WIDTH : (capacity))
+#define TABLE_BYTES(capacity) \
+  ((sizeof(ObjString*) + sizeof(Value)) * (size_t) (capacity) + CTRL_LEN(capacity))
+
+// Bitmasks have one bit per slot of the group.
+static inline uint32_t group_match(const int8_t* group, int8_t tag) {
+#ifdef __SSE2__
+  __m128i ctrl = _mm_loadu_si128((const __m128i*) group);
+  return (uint32_t) _mm_movemask_epi8(_mm_cmpeq_epi8(ctrl, _mm_set1_epi8(tag)));
+#else
+  uint32_t mask = 0;
+
+  for (int i = 0; i < TABLE_GROUP_WIDTH; i++) {
+    mask |= (uint32_t) (group[i] == tag) << i;
+  }
+
+  return mask;
+#endif
+}
+
+static inline uint32_t group_match_empty(const int8_t* group) {
+  return group_match(group, CTRL_EMPTY);
+}
+
+// Both markers have their top bit set, full slots never do.
+static inline uint32_t group_match_empty_or_deleted(const int8_t* group) {
+#ifdef __SSE2__
+  return (uint32_t) _mm_movemask_epi8(_mm_loadu_si128((const __m128i*) group));
+#else
+  uint32_t mask = 0;
+
+  for (int i = 0; i < TABLE_GROUP_WIDTH; i++) {
+    mask |= (uint32_t) (group[i] < 0) << i;
+  }
+
+  return mask;
+#endif
+}
+
+static inline int group_len(int capacity) {
+  return capacity <= TABLE_GROUP_WIDTH ? 1 : capacity / TABLE_GROUP_WIDTH;
+}
+
+static inline uint32_t group_slots(int capacity) {
+  return capacity < TABLE_GROUP_WIDTH ? (1U << capacity) - 1 : 0xFFFF;
+}
+
+static inline Value* block_values(ObjString** keys, int capacity) {
+  return (Value*) (keys + capacity);
+}
+
+static inline int8_t* block_ctrl(ObjString** keys, int capacity) {
+  return (int8_t*) (block_values(keys, capacity) + capacity);
+}
 
 void table_init(Table* table) {
   table->len = 0;
   table->capacity = 0;
-  table->entries = NULL;
+  table->growth_left = 0;
+
+  table->old_capacity = 0;
+  table->migrated = 0;
+
+  table->keys = NULL;
+  table->values = NULL;
+  table->ctrl = NULL;
+
+  table->old_keys = NULL;
 }
 
 void table_free(Table* table) {
-  MEM_FREE_ARRAY(Entry, table->entries, table->capacity);
+  if (table->capacity > 0) {
+    MEM_FREE_ARRAY(uint8_t, table->keys, TABLE_BYTES(table->capacity));
+  }
+
+  if (table->old_keys != NULL) {
+    MEM_FREE_ARRAY(uint8_t, table->old_keys, TABLE_BYTES(table->old_capacity));
+  }
+
   table_init(table);
 }
 
-static Entry* find_entry(Entry* entries, int capacity, struct ObjString* key) {
-  uint32_t idx = key->hash & (capacity - 1);
-  Entry* tombstone = NULL;
+// Groups are visited in triangular order, which covers all of them for power-of-two counts.
+static int find_slot(const int8_t* ctrls, ObjString** keys, int capacity, ObjString* key) {
+  uint32_t group_mask = group_len(capacity) - 1;
+  uint32_t group = HASH_GROUP(key->hash) & group_mask;
+  int8_t tag = HASH_TAG(key->hash);
 
-  while (true) {
-    Entry* entry = &entries[idx];
-
-    if (entry->key == NULL) {
-      if (IS_NIL(entry->value)) {
-        return tombstone != NULL ? tombstone : entry;
-      } else {
-        if (tombstone == NULL) {
-          tombstone = entry;
-        }
+  for (uint32_t step = 1;; step++) {
+    const int8_t* ctrl = &ctrls[group * TABLE_GROUP_WIDTH];
+
+    for (uint32_t mask = group_match(ctrl, tag); mask != 0; mask &= mask - 1) {
+      int idx = (int) (group * TABLE_GROUP_WIDTH) + __builtin_ctz(mask);
+
+      if (keys[idx] == key) {
+        return idx;
       }
-    } else if (entry->key == key) {
-      return entry;
     }
 
-    idx = (idx + 1) & (capacity - 1);
+    if (group_match_empty(ctrl) != 0) {
+      return -1;
+    }
+
+    group = (group + step) & group_mask;
   }
 }
 
-static void adjust_capacity(Table* table, int capacity) {
-  Entry* entries = MEM_ALLOC(Entry, capacity);
+// Returns the first empty or deleted slot on the probe sequence of `hash`.
+static int find_insert_slot(const int8_t* ctrls, int capacity, uint32_t hash) {
+  uint32_t group_mask = group_len(capacity) - 1;
+  uint32_t group = HASH_GROUP(hash) & group_mask;
 
-  for (int i = 0; i < capacity; i++) {
-    entries[i].key = NULL;
-    entries[i].value = NIL_VAL;
+  for (uint32_t step = 1;; step++) {
+    const int8_t* ctrl = &ctrls[group * TABLE_GROUP_WIDTH];
+    uint32_t mask = group_match_empty_or_deleted(ctrl) & group_slots(capacity);
+
+    if (mask != 0) {
+      return (int) (group * TABLE_GROUP_WIDTH) + __builtin_ctz(mask);
+    }
+
+    group = (group + step) & group_mask;
   }
+}
 
-  table->len = 0;
+// Moves up to `slot_len` old slots into the current arrays. Space for every live old entry was
+// reserved out of `growth_left` when the resize started, so only landing on a tombstone gives
+// some of it back.
+static void migrate(Table* table, int slot_len) {
+  ObjString** old_keys = table->old_keys;
+  Value* old_values = block_values(old_keys, table->old_capacity);
+  int8_t* old_ctrl = block_ctrl(old_keys, table->old_capacity);
+
+  int end = table->migrated + slot_len;
+  end = end < table->old_capacity ? end : table->old_capacity;
 
-  for (int i = 0; i < table->capacity; i++) {
-    Entry* entry = &table->entries[i];
-    if (entry->key == NULL) {
+  for (int i = table->migrated; i < end; i++) {
+    if (old_ctrl[i] < 0) {
       continue;
     }
 
-    Entry* dest = find_entry(entries, capacity, entry->key);
+    ObjString* key = old_keys[i];
+    int idx = find_insert_slot(table->ctrl, table->capacity, key->hash);
+
+    // Lookups still probe the old arrays, which must not find the stale copy.
+    old_ctrl[i] = CTRL_DELETED;
+
+    if (table->ctrl[idx] != CTRL_EMPTY) {
+      table->growth_left += 1;
+    }
+
+    table->ctrl[idx] = HASH_TAG(key->hash);
+    table->keys[idx] = key;
+    table->values[idx] = old_values[i];
+  }
+
+  table->migrated = end;
+
+  if (end == table->old_capacity) {
+    MEM_FREE_ARRAY(uint8_t, old_keys, TABLE_BYTES(table->old_capacity));
+    table->old_keys = NULL;
+    table->old_capacity = 0;
+    table->migrated = 0;
+  }
+}
+
+static inline void migrate_step(Table* table) {
+  if (table->old_keys != NULL) {
+    migrate(table, MIGRATE_STEP);
+  }
+}
+
+static void resize(Table* table, int capacity) {
+  if (table->old_keys != NULL) {
+    migrate(table, table->old_capacity);
+  }
+
+  ObjString** keys = (ObjString**) MEM_ALLOC(uint8_t, TABLE_BYTES(capacity));
+  int8_t* ctrl = block_ctrl(keys, capacity);
+
+  memset(ctrl, CTRL_EMPTY, CTRL_LEN(capacity));
 
-    dest->key = entry->key;
-    dest->value = entry->value;
-    table->len += 1;
+  if (table->capacity > 0) {
+    table->old_keys = table->keys;
+    table->old_capacity = table->capacity;
+    table->migrated = 0;
   }
 
-  MEM_FREE_ARRAY(Entry, table->entries, table->capacity);
-  table->entries = entries;
   table->capacity = capacity;
+  table->growth_left = MAX_GROWTH(capacity) - table->len;
+  table->keys = keys;
+  table->values = block_values(keys, capacity);
+  table->ctrl = ctrl;
+
+  if (table->old_keys != NULL && table->old_capacity < INCREMENTAL_MIN_CAPACITY) {
+    migrate(table, table->old_capacity);
+  }
+}
+
+// Smallest capacity that holds `len` entries at no more than half the maximum load.
+static int fitting_capacity(int len) {
+  int capacity = TABLE_MIN_CAPACITY;
+
+  while (len > MAX_GROWTH(capacity) / 2) {
+    capacity *= 2;
+  }
+
+  return capacity;
+}
+
+// Called when no slot can be claimed without exceeding the load factor. If tombstones take up
+// most of the used slots, they are purged at the current capacity instead of growing.
+static void make_room(Table* table) {
+  if (table->capacity == 0) {
+    resize(table, TABLE_MIN_CAPACITY);
+  } else if (table->len < MAX_GROWTH(table->capacity) / 2) {
+    resize(table, table->capacity);
+  } else {
+    resize(table, table->capacity * 2);
+  }
+}
+
+// Sizes an empty table so that `len` entries fit without growing.
+void table_reserve(Table* table, int len) {
+  if (table->capacity > 0) {
+    return;
+  }
+
+  int capacity = TABLE_MIN_CAPACITY;
+
+  while (len > MAX_GROWTH(capacity)) {
+    capacity *= 2;
+  }
+
+  resize(table, capacity);
 }
 
 bool table_set(Table* table, ObjString* key, Value value) {
-  if (table->len + 1 > table->capacity * TABLE_MAX_LOAD) {
-    int capacity = MEM_GROW_CAPACITY(table->capacity);
-    adjust_capacity(table, capacity);
+  migrate_step(table);
+
+  if (table->len > 0) {
+    int idx = find_slot(table->ctrl, table->keys, table->capacity, key);
+
+    if (idx != -1) {
+      table->values[idx] = value;
+      return false;
+    }
+
+    if (table->old_keys != NULL) {
+      idx = find_slot(block_ctrl(table->old_keys, table->old_capacity), table->old_keys,
+                      table->old_capacity, key);
+
+      if (idx != -1) {
+        block_values(table->old_keys, table->old_capacity)[idx] = value;
+        return false;
+      }
+    }
+  }
+
+  if (table->growth_left == 0) {
+    make_room(table);
   }
 
-  Entry* entry = find_entry(table->entries, table->capacity, key);
-  bool is_new = entry->key == NULL;
+  int idx = find_insert_slot(table->ctrl, table->capacity, key->hash);
 
-  if (is_new && IS_NIL(entry->value)) {
-    table->len += 1;
+  if (table->ctrl[idx] == CTRL_EMPTY) {
+    table->growth_left -= 1;
   }
 
-  entry->key = key;
-  entry->value = value;
+  table->ctrl[idx] = HASH_TAG(key->hash);
+  table->keys[idx] = key;
+  table->values[idx] = value;
+  table->len += 1;
 
-  return is_new;
+  return true;
 }
 
 bool table_get(Table* table, ObjString* key, Value* dest) {
@@ -95,13 +308,26 @@ bool table_get(Table* table, ObjString* key, Value* dest) {
     return false;
   }
 
-  Entry* entry = find_entry(table->entries, table->capacity, key);
-  if (entry->key == NULL) {
-    return false;
+  migrate_step(table);
+
+  int idx = find_slot(table->ctrl, table->keys, table->capacity, key);
+
+  if (idx != -1) {
+    *dest = table->values[idx];
+    return true;
   }
 
-  *dest = entry->value;
-  return true;
+  if (table->old_keys != NULL) {
+    idx = find_slot(block_ctrl(table->old_keys, table->old_capacity), table->old_keys,
+                    table->old_capacity, key);
+
+    if (idx != -1) {
+      *dest = block_values(table->old_keys, table->old_capacity)[idx];
+      return true;
+    }
+  }
+
+  return false;
 }
 
 bool table_remove(Table* table, ObjString* key) {
@@ -109,23 +335,89 @@ bool table_remove(Table* table, ObjString* key) {
     return false;
   }
 
-  Entry* entry = find_entry(table->entries, table->capacity, key);
-  if (entry->key == NULL) {
+  migrate_step(table);
+
+  int idx = find_slot(table->ctrl, table->keys, table->capacity, key);
+
+  if (idx != -1) {
+    // A probe that reaches a group with an empty slot stops there, so no key past this group
+    // depends on the slot staying occupied and it can be handed back as empty.
+    const int8_t* group = &table->ctrl[idx - idx % TABLE_GROUP_WIDTH];
+
+    if (group_match_empty(group) != 0) {
+      table->ctrl[idx] = CTRL_EMPTY;
+      table->growth_left += 1;
+    } else {
+      table->ctrl[idx] = CTRL_DELETED;
+    }
+  } else if (table->old_keys != NULL) {
+    idx = find_slot(block_ctrl(table->old_keys, table->old_capacity), table->old_keys,
+                    table->old_capacity, key);
+
+    if (idx == -1) {
+      return false;
+    }
+
+    // The entry will never be migrated, so release the space reserved for it.
+    block_ctrl(table->old_keys, table->old_capacity)[idx] = CTRL_DELETED;
+    table->growth_left += 1;
+  } else {
     return false;
   }
 
-  entry->key = NULL;
-  entry->value = BOOL_VAL(true);
+  table->len -= 1;
+
+  // Shrink once the table drops below an eighth full; this also drops every tombstone.
+  if (table->old_keys == NULL && table->capacity > TABLE_MIN_CAPACITY &&
+      table->len < table->capacity / 8) {
+    resize(table, fitting_capacity(table->len));
+  }
 
   return true;
 }
 
 void table_add_all(Table* src, Table* dest) {
-  for (int i = 0; i < src->capacity; i++) {
-    Entry* entry = &src->entries[i];
+  int cursor = 0;
+  ObjString* key;
+  Value value;
+
+  while (table_next(src, &cursor, &key, &value)) {
+    table_set(dest, key, value);
+  }
+}
+
+// Walks the live entries, including those still waiting in the old arrays. Start with a zeroed
+// cursor; the table must not be modified during the walk.
+bool table_next(Table* table, int* cursor, ObjString** key, Value* value) {
+  while (*cursor < table->capacity) {
+    int idx = (*cursor)++;
+
+    if (table->ctrl[idx] >= 0) {
+      *key = table->keys[idx];
+      *value = table->values[idx];
+      return true;
+    }
+  }
+
+  if (table->old_keys == NULL) {
+    return false;
+  }
+
+  const int8_t* old_ctrl = block_ctrl(table->old_keys, table->old_capacity);
+
+  while (true) {
+    int idx = table->migrated + (*cursor - table->capacity);
+
+    if (idx >= table->old_capacity) {
+      return false;
+    }
+
+    *cursor += 1;
 
-    if (entry->key != NULL) {
-      table_set(dest, entry->key, entry->value);
+    if (old_ctrl[idx] >= 0) {
+      *key = table->old_keys[idx];
+      *value = block_values(table->old_keys, table->old_capacity)[idx];
+      return true;
     }
   }
 }
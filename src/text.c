@@ -0,0 +1,74 @@
+#include "text.h"
+
+#include <stdint.h>
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// Finds candidates with memchr on the first byte, which the C library already vectorizes.
+static int find_scalar(const char* haystack, int haystack_len, const char* needle, int needle_len,
+                       int start) {
+  int last = haystack_len - needle_len;
+
+  while (start <= last) {
+    const char* hit = memchr(haystack + start, needle[0], (size_t) (last - start + 1));
+
+    if (hit == NULL) {
+      return -1;
+    }
+
+    int idx = (int) (hit - haystack);
+
+    if (memcmp(hit + 1, needle + 1, (size_t) (needle_len - 1)) == 0) {
+      return idx;
+    }
+
+    start = idx + 1;
+  }
+
+  return -1;
+}
+
+int text_find(const char* haystack, int haystack_len, const char* needle, int needle_len) {
+  if (needle_len == 0) {
+    return 0;
+  }
+
+  if (needle_len > haystack_len) {
+    return -1;
+  }
+
+  if (needle_len == 1) {
+    const char* hit = memchr(haystack, needle[0], (size_t) haystack_len);
+    return hit == NULL ? -1 : (int) (hit - haystack);
+  }
+
+  int start = 0;
+
+#ifdef __SSE2__
+  // Compare the first and last needle bytes against 16 candidate positions at once, and only
+  // check the middle of the ones where both match.
+  __m128i first = _mm_set1_epi8(needle[0]);
+  __m128i last = _mm_set1_epi8(needle[needle_len - 1]);
+
+  for (; start + 16 + needle_len - 1 <= haystack_len; start += 16) {
+    __m128i block_first = _mm_loadu_si128((const __m128i*) (haystack + start));
+    __m128i block_last = _mm_loadu_si128((const __m128i*) (haystack + start + needle_len - 1));
+
+    uint32_t mask = (uint32_t) _mm_movemask_epi8(
+        _mm_and_si128(_mm_cmpeq_epi8(block_first, first), _mm_cmpeq_epi8(block_last, last)));
+
+    for (; mask != 0; mask &= mask - 1) {
+      int idx = start + __builtin_ctz(mask);
+
+      if (memcmp(haystack + idx + 1, needle + 1, (size_t) (needle_len - 2)) == 0) {
+        return idx;
+      }
+    }
+  }
+#endif
+
+  return find_scalar(haystack, haystack_len, needle, needle_len, start);
+}
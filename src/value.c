@@ -1,11 +1,40 @@
 #include "value.h"
 
+#include <stdint.h>
+#include <string.h>
+
+#include "hash.h"
+#include "object.h"
+
 bool value_is_falsey(Value value) {
   return IS_NIL(value) || (IS_BOOL(value) && !AS_BOOL(value));
 }
 
+// Succeeds when `number` has no fractional part and fits in 64 bits.
+bool value_as_int(double number, int64_t* dest) {
+  // 2^63 is exactly representable, unlike INT64_MAX.
+  if (!(number >= -9223372036854775808.0 && number < 9223372036854775808.0) ||
+      number != (double) (int64_t) number) {
+    return false;
+  }
+
+  *dest = (int64_t) number;
+  return true;
+}
+
 bool value_is_equal(Value a, Value b) {
   if (a.kind != b.kind) {
+    // An integer equals a double of exactly the same value.
+    if (IS_INT(a) && IS_NUMBER(b)) {
+      int64_t integer;
+      return value_as_int(AS_NUMBER(b), &integer) && integer == AS_INT(a);
+    }
+
+    if (IS_NUMBER(a) && IS_INT(b)) {
+      int64_t integer;
+      return value_as_int(AS_NUMBER(a), &integer) && integer == AS_INT(b);
+    }
+
     return false;
   }
 
@@ -19,7 +48,67 @@ bool value_is_equal(Value a, Value b) {
     case VAL_NUMBER:
       return AS_NUMBER(a) == AS_NUMBER(b);
 
+    case VAL_INT:
+      return AS_INT(a) == AS_INT(b);
+
     case VAL_OBJ:
-      return AS_OBJ(a) == AS_OBJ(b);
+      if (AS_OBJ(a) == AS_OBJ(b)) {
+        return true;
+      }
+
+      // Interned strings only equal themselves, but a slice has to be compared by content.
+      if ((IS_SLICE(a) || IS_SLICE(b)) && IS_TEXT(a) && IS_TEXT(b)) {
+        return text_len(a) == text_len(b) && memcmp(text_chars(a), text_chars(b), text_len(a)) == 0;
+      }
+
+      // Binding a method may or may not reuse an instance's cached bound method, so bound methods
+      // compare by what they bind rather than by identity.
+      if (IS_BOUND_METHOD(a) && IS_BOUND_METHOD(b)) {
+        return AS_BOUND_METHOD(a)->method == AS_BOUND_METHOD(b)->method &&
+               value_is_equal(AS_BOUND_METHOD(a)->receiver, AS_BOUND_METHOD(b)->receiver);
+      }
+
+      return false;
   }
 }
+
+// Consistent with value_is_equal: doubles with an integral value hash like the equal integer
+// (which also covers 0 and -0), and slices hash their content the same way strings do.
+uint32_t value_hash(Value value) {
+  switch (value.kind) {
+    case VAL_NIL:
+      return hash_u64(0);
+
+    case VAL_BOOL:
+      return hash_u64(AS_BOOL(value) ? 2 : 1);
+
+    case VAL_NUMBER: {
+      int64_t integer;
+
+      if (value_as_int(AS_NUMBER(value), &integer)) {
+        return hash_u64((uint64_t) integer);
+      }
+
+      uint64_t bits;
+
+      memcpy(&bits, &AS_NUMBER(value), sizeof(bits));
+      return hash_u64(bits);
+    }
+
+    case VAL_INT:
+      return hash_u64((uint64_t) AS_INT(value));
+
+    case VAL_OBJ:
+      if (IS_STRING(value)) {
+        return AS_STRING(value)->hash;
+      }
+
+      if (IS_SLICE(value)) {
+        return hash_string(text_chars(value), text_len(value));
+      }
+
+      return hash_u64((uint64_t) (uintptr_t) AS_OBJ(value));
+  }
+
+  return 0;
+}
@@ -12,7 +12,7 @@ void valuelist_init(ValueList* list) {
 }
 
 void valuelist_free(ValueList* list) {
-  MEM_FREE_ARRAY(Value, list->values, list->len);
+  MEM_FREE_ARRAY(Value, list->values, list->capacity);
   valuelist_init(list);
 }
 
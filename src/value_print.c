@@ -1,7 +1,11 @@
+#include <inttypes.h>
+#include <stdbool.h>
 #include <stdio.h>
 
+#include "map.h"
 #include "object.h"
 #include "value.h"
+#include "value_list.h"
 
 static void object_print(Value value) {
   switch (OBJ_KIND(value)) {
@@ -9,13 +13,17 @@ static void object_print(Value value) {
       printf("%s", AS_CSTRING(value));
       break;
 
+    case OBJ_SLICE:
+      printf("%.*s", text_len(value), text_chars(value));
+      break;
+
     case OBJ_FUNCTION: {
       ObjFunction* function = AS_FUNCTION(value);
 
       if (function->name == NULL) {
         printf("<script>");
       } else {
-        printf("<function '%s'(%d)>", function->name->chars, function->arity);
+        printf("<function '%s'(%d)>", string_chars(function->name), function->arity);
       }
 
       break;
@@ -34,16 +42,71 @@ static void object_print(Value value) {
       break;
 
     case OBJ_CLASS:
-      printf("%s", AS_CLASS(value)->name->chars);
+      printf("%s", string_chars(AS_CLASS(value)->name));
       break;
 
     case OBJ_INSTANCE:
-      printf("instance of %s", AS_INSTANCE(value)->class->name->chars);
+      printf("instance of %s", string_chars(AS_INSTANCE(value)->class->name));
       break;
 
     case OBJ_BOUND_METHOD:
-      object_print(OBJ_VAL(AS_BOUND_METHOD(value)->method->function));
+      object_print(OBJ_VAL(AS_BOUND_METHOD(value)->method));
+      break;
+
+    case OBJ_LIST: {
+      ValueList* items = &AS_LIST(value)->items;
+
+      printf("[");
+
+      for (int i = 0; i < items->len; i++) {
+        if (i > 0) {
+          printf(", ");
+        }
+
+        value_print(items->values[i]);
+      }
+
+      printf("]");
+      break;
+    }
+
+    case OBJ_FLOAT64_ARRAY: {
+      ObjFloat64Array* array = AS_FLOAT64_ARRAY(value);
+
+      printf("float64array[");
+
+      for (int i = 0; i < array->len; i++) {
+        printf(i > 0 ? ", %g" : "%g", array->values[i]);
+      }
+
+      printf("]");
+      break;
+    }
+
+    case OBJ_MAP: {
+      Map* map = &AS_MAP(value)->map;
+      int cursor = 0;
+      Value key;
+      Value item;
+      bool is_first = true;
+
+      printf("{");
+
+      while (map_next(map, &cursor, &key, &item)) {
+        if (!is_first) {
+          printf(", ");
+        }
+
+        is_first = false;
+
+        value_print(key);
+        printf(": ");
+        value_print(item);
+      }
+
+      printf("}");
       break;
+    }
   }
 }
 
@@ -61,6 +124,10 @@ void value_print(Value value) {
       printf("%g", AS_NUMBER(value));
       break;
 
+    case VAL_INT:
+      printf("%" PRId64, AS_INT(value));
+      break;
+
     case VAL_OBJ:
       object_print(value);
       break;
@@ -0,0 +1,313 @@
+#include "verify.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "chunk.h"
+#include "mem.h"
+#include "object.h"
+#include "op.h"
+#include "value.h"
+
+// Marks the bytes of `depths` that are operands rather than the start of an instruction.
+#define DEPTH_OPERAND -2
+
+typedef struct {
+  ObjFunction* function;
+
+  // Stack depth on entry to the instruction at each offset, or -1 if it isn't reached yet.
+  int* depths;
+
+  // Offsets that were reached but not followed yet.
+  int* pending;
+  int pending_len;
+
+  bool is_valid;
+} Verifier;
+
+// Marks the function as bad. With VERIFY_CODE defined, the reason is reported along with its code.
+static void fail(Verifier* verifier, int offset, const char* message) {
+  verifier->is_valid = false;
+
+#ifdef VERIFY_CODE
+  ObjFunction* function = verifier->function;
+  const char* name = function->name == NULL ? "<script>" : string_chars(function->name);
+
+  fprintf(stderr, "[Line:%d] Bad code in %s at %04d: %s\n",
+          chunk_get_line(&function->chunk, offset), name, offset, message);
+  chunk_print(&function->chunk, name);
+#else
+  (void) offset;
+  (void) message;
+#endif
+}
+
+static int instr_size(Chunk* chunk, int offset) {
+  switch (op_shape(chunk->code[offset])) {
+    case SHAPE_NONE:
+      return 1;
+
+    case SHAPE_BYTE:
+      return 2;
+
+    case SHAPE_TWO_BYTES:
+    case SHAPE_JUMP:
+      return 3;
+
+    case SHAPE_SLOT_JUMP:
+      return 4;
+
+    case SHAPE_GUARD:
+      return 5;
+
+    case SHAPE_CLOSURE: {
+      // A bad operand is reported when the instruction is followed.
+      if (offset + 1 >= chunk->len || chunk->code[offset + 1] >= chunk->consts.len) {
+        return 2;
+      }
+
+      Value function = chunk->consts.values[chunk->code[offset + 1]];
+      return IS_FUNCTION(function) ? 2 + 2 * AS_FUNCTION(function)->upvalue_len : 2;
+    }
+  }
+
+  return 1;
+}
+
+// Ops whose first operand is an index into the constants, which has to be a string for all but
+// OP_LOAD, OP_CLOSURE and OP_JUMP_UNLESS_CALLEE.
+static bool op_has_constant(uint8_t op) {
+  switch (op) {
+    case OP_LOAD:
+    case OP_DEFINE_GLOBAL:
+    case OP_GET_GLOBAL:
+    case OP_SET_GLOBAL:
+    case OP_CLASS:
+    case OP_GET_PROPERTY:
+    case OP_SET_PROPERTY:
+    case OP_METHOD:
+    case OP_GET_SUPER:
+    case OP_INVOKE:
+    case OP_SUPER_INVOKE:
+    case OP_JUMP_UNLESS_CALLEE:
+    case OP_CLOSURE:
+      return true;
+
+    default:
+      return false;
+  }
+}
+
+// Returns false if the constant is out of range, in which case the rest of the instruction mustn't
+// be looked at.
+static bool check_constant(Verifier* verifier, int offset, uint8_t op, uint8_t arg) {
+  ValueList* consts = &verifier->function->chunk.consts;
+
+  if (arg >= consts->len) {
+    fail(verifier, offset, "Constant outside the constants.");
+    return false;
+  }
+
+  Value value = consts->values[arg];
+
+  switch (op) {
+    case OP_LOAD:
+      // A function loaded as it is runs without a closure to hold its upvalues.
+      if (IS_FUNCTION(value) && AS_FUNCTION(value)->upvalue_len > 0) {
+        fail(verifier, offset, "Function with upvalues loaded without a closure.");
+      }
+      break;
+
+    case OP_CLOSURE:
+      if (!IS_FUNCTION(value)) {
+        fail(verifier, offset, "Closure of a constant that isn't a function.");
+      }
+      break;
+
+    case OP_JUMP_UNLESS_CALLEE:
+      if (!IS_OBJ(value)) {
+        fail(verifier, offset, "Callee that isn't an object.");
+      }
+      break;
+
+    default:
+      if (!IS_STRING(value)) {
+        fail(verifier, offset, "Name that isn't a string.");
+      }
+      break;
+  }
+
+  return true;
+}
+
+// Each upvalue of a new closure captures a slot of the frame or an upvalue of the running closure.
+static void check_captures(Verifier* verifier, int offset, int depth) {
+  Chunk* chunk = &verifier->function->chunk;
+  Value function = chunk->consts.values[chunk->code[offset + 1]];
+
+  if (!IS_FUNCTION(function)) {
+    return;
+  }
+
+  for (int i = 0; i < AS_FUNCTION(function)->upvalue_len; i++) {
+    uint8_t kind = chunk->code[offset + 2 + 2 * i];
+    uint8_t idx = chunk->code[offset + 3 + 2 * i];
+
+    if (kind == CAPTURE_UPVALUE ? idx >= verifier->function->upvalue_len
+                                : kind > CAPTURE_STACK || idx >= depth) {
+      fail(verifier, offset, "Capture outside the frame or closure.");
+    }
+  }
+}
+
+// Control reaches `target` with `depth` values on the stack.
+static void reach(Verifier* verifier, int from, int target, int depth) {
+  if (target < 0 || target >= verifier->function->chunk.len) {
+    fail(verifier, from, "Control leaves the code.");
+  } else if (verifier->depths[target] == DEPTH_OPERAND) {
+    fail(verifier, from, "Jump into the middle of an instruction.");
+  } else if (verifier->depths[target] == -1) {
+    verifier->depths[target] = depth;
+    verifier->pending[verifier->pending_len++] = target;
+  } else if (verifier->depths[target] != depth) {
+    fail(verifier, from, "Paths join with different stack depths.");
+  }
+}
+
+// Follows the instruction at `offset`, returning the stack depth after it.
+static int follow(Verifier* verifier, int offset) {
+  Chunk* chunk = &verifier->function->chunk;
+  int depth = verifier->depths[offset];
+
+  uint8_t op = chunk->code[offset];
+  int size = instr_size(chunk, offset);
+  OpShape shape = op_shape(op);
+
+  uint8_t arg = size > 1 ? chunk->code[offset + 1] : 0;
+  uint8_t arg2 = shape == SHAPE_TWO_BYTES || shape == SHAPE_GUARD ? chunk->code[offset + 2] : 0;
+  int pops, pushes;
+
+  if (!op_stack_effect(op, arg, arg2, &pops, &pushes)) {
+    fail(verifier, offset, "Unknown opcode.");
+    return depth;
+  }
+
+  if (depth < pops) {
+    fail(verifier, offset, "Stack underflow.");
+    return depth;
+  }
+
+  if (op_has_constant(op) && !check_constant(verifier, offset, op, arg)) {
+    return depth;
+  }
+
+  switch (op) {
+    case OP_GET_LOCAL:
+    case OP_SET_LOCAL:
+    case OP_INC_LOCAL:
+    case OP_CHECK_INT:
+    case OP_CHECK_FLOAT:
+      if (arg >= depth) {
+        fail(verifier, offset, "Slot outside the stack.");
+      }
+      break;
+
+    case OP_FOR_PREP:
+    case OP_FOR_LOOP:
+      if (arg + 3 >= depth) {
+        fail(verifier, offset, "Slot outside the stack.");
+      }
+      break;
+
+    case OP_GET_UPVALUE:
+    case OP_SET_UPVALUE:
+      if (arg >= verifier->function->upvalue_len) {
+        fail(verifier, offset, "Upvalue outside the closure.");
+      }
+      break;
+
+    case OP_JUMP_UNLESS_CALLEE:
+      if (arg2 >= depth) {
+        fail(verifier, offset, "Slot outside the stack.");
+      }
+      break;
+
+    case OP_CLOSURE:
+      check_captures(verifier, offset, depth);
+      break;
+
+    default:
+      break;
+  }
+
+  int after = depth - pops + pushes;
+
+  if (shape_jumps(shape)) {
+    int distance = (chunk->code[offset + size - 2] << 8) | chunk->code[offset + size - 1];
+    int target = offset + size + (op_jumps_back(op) ? -distance : distance);
+
+    reach(verifier, offset, target, op_keeps_operand(op) ? depth : after);
+  }
+
+  if (op_falls_through(op)) {
+    reach(verifier, offset, offset + size, after);
+  }
+
+  return after;
+}
+
+bool verify_function(ObjFunction* function, int* max_stack) {
+  Chunk* chunk = &function->chunk;
+
+  Verifier verifier;
+  verifier.function = function;
+  verifier.depths = MEM_ALLOC(int, chunk->len);
+  verifier.pending = MEM_ALLOC(int, chunk->len);
+  verifier.pending_len = 0;
+  verifier.is_valid = true;
+
+  for (int offset = 0; offset < chunk->len;) {
+    int size = instr_size(chunk, offset);
+
+    if (offset + size > chunk->len) {
+      fail(&verifier, offset, "Instruction runs past the end of the code.");
+      size = chunk->len - offset;
+    }
+
+    verifier.depths[offset] = -1;
+
+    for (int i = offset + 1; i < offset + size; i++) {
+      verifier.depths[i] = DEPTH_OPERAND;
+    }
+
+    offset += size;
+  }
+
+  // The callee followed by the arguments.
+  int max = function->arity + 1;
+
+  if (chunk->len > 0) {
+    reach(&verifier, 0, 0, max);
+  }
+
+  while (verifier.pending_len > 0 && verifier.is_valid) {
+    int offset = verifier.pending[--verifier.pending_len];
+
+    if (offset + instr_size(chunk, offset) > chunk->len) {
+      continue;
+    }
+
+    int depth = follow(&verifier, offset);
+
+    if (depth > max) {
+      max = depth;
+    }
+  }
+
+  MEM_FREE_ARRAY(int, verifier.depths, chunk->len);
+  MEM_FREE_ARRAY(int, verifier.pending, chunk->len);
+
+  *max_stack = max;
+  return verifier.is_valid;
+}
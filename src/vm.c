@@ -1,36 +1,35 @@
 #include "vm.h"
 
+#include <inttypes.h>
+#include <math.h>
 #include <stdarg.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <time.h>
 
 #include "chunk.h"
-#include "mem.h"
+#include "map.h"
+#include "native.h"
 #include "object.h"
 #include "op.h"
+#include "string_set.h"
 #include "table.h"
 #include "value.h"
+#include "value_list.h"
 
 VM vm;
 
 static void reset_stack(void) {
   vm.stack_top = vm.stack;
   vm.frames_len = 0;
-}
 
-static Value native_clock(int arg_len, Value* args) {
-  (void) arg_len;
-  (void) args;
-  return NUMBER_VAL((double) clock() / CLOCKS_PER_SEC);
+  memset(vm.open_upvalues, 0, sizeof(vm.open_upvalues));
 }
 
 void vm_init(void) {
   vm.objects = NULL;
-  vm.open_upvalues = NULL;
 
   vm.gray_len = 0;
   vm.gray_capacity = 0;
@@ -39,19 +38,19 @@ void vm_init(void) {
   vm.bytes_allocated = 0;
   vm.gc_target = (size_t) (1024 * 1024);
 
-  table_init(&vm.strings);
+  stringset_init(&vm.strings);
   table_init(&vm.globals);
   reset_stack();
 
   vm.init_string = NULL;
   vm.init_string = string_copy("init", 4);
 
-  define_native("clock", native_clock);
+  natives_define();
 }
 
 void vm_free(void) {
   table_free(&vm.globals);
-  table_free(&vm.strings);
+  stringset_free(&vm.strings);
   vm.init_string = NULL;
 
   Obj* object = vm.objects;
@@ -79,9 +78,9 @@ static Value peek(int idx) {
   return vm.stack_top[-1 - idx];
 }
 
-static void runtime_error(const char* format, ...) {
+void runtime_error(const char* format, ...) {
   CallFrame* frame = &vm.frames[vm.frames_len - 1];
-  Chunk* chunk = &frame->closure->function->chunk;
+  Chunk* chunk = &frame->function->chunk;
 
   va_list args;
   va_start(args, format);
@@ -95,24 +94,35 @@ static void runtime_error(const char* format, ...) {
   printf("== Stack trace ==\n");
   for (int i = vm.frames_len - 1; i >= 0; i--) {
     CallFrame* frame = &vm.frames[i];
-    ObjFunction* function = frame->closure->function;
+    ObjFunction* function = frame->function;
 
     int instr = (int) (frame->ip - function->chunk.code - 1);
-    fprintf(stderr, "[Line %d] in ", chunk_get_line(chunk, instr));
+    fprintf(stderr, "[Line %d] in ", chunk_get_line(&function->chunk, instr));
 
     if (function->name == NULL) {
       fprintf(stderr, "script.\n");
     } else {
-      fprintf(stderr, "%s()\n", function->name->chars);
+      fprintf(stderr, "%s()\n", string_chars(function->name));
     }
   }
 
   reset_stack();
 }
 
-static bool call(ObjClosure* closure, int arg_len) {
-  if (arg_len != closure->function->arity) {
-    runtime_error("Expected %d arguments, but got %d.", closure->function->arity, arg_len);
+// `callee` is either a function or a closure.
+static bool call(Obj* callee, int arg_len) {
+  ObjClosure* closure = NULL;
+  ObjFunction* function;
+
+  if (callee->kind == OBJ_CLOSURE) {
+    closure = (ObjClosure*) callee;
+    function = closure->function;
+  } else {
+    function = (ObjFunction*) callee;
+  }
+
+  if (arg_len != function->arity) {
+    runtime_error("Expected %d arguments, but got %d.", function->arity, arg_len);
     return false;
   }
 
@@ -121,11 +131,33 @@ static bool call(ObjClosure* closure, int arg_len) {
     return false;
   }
 
+  // An accessor puts the field straight in place of the receiver. Without the field, the method
+  // runs as usual to bind a method of that name or fail.
+  if (function->field != NULL && IS_INSTANCE(vm.stack_top[-1])) {
+    Value value;
+
+    if (table_get(&AS_INSTANCE(vm.stack_top[-1])->fields, function->field, &value)) {
+      vm.stack_top[-1] = value;
+      return true;
+    }
+  }
+
+  // Checking once here that the deepest the frame's stack gets fits lets the instructions push
+  // without checking.
+  Value* slots = vm.stack_top - arg_len - 1;
+
+  if (slots + function->max_stack + STACK_RESERVE > vm.stack + STACK_MAX) {
+    runtime_error("Stack overflow.");
+    return false;
+  }
+
   CallFrame* frame = &vm.frames[vm.frames_len++];
 
+  frame->function = function;
   frame->closure = closure;
-  frame->ip = closure->function->chunk.code;
-  frame->slots = vm.stack_top - arg_len - 1;
+  frame->ip = function->chunk.code;
+  frame->slots = slots;
+  frame->open_upvalue_len = 0;
 
   return true;
 }
@@ -133,12 +165,24 @@ static bool call(ObjClosure* closure, int arg_len) {
 static bool call_value(Value callee, int arg_len) {
   if (IS_OBJ(callee)) {
     switch (OBJ_KIND(callee)) {
+      case OBJ_FUNCTION:
       case OBJ_CLOSURE:
-        return call(AS_CLOSURE(callee), arg_len);
+        return call(AS_OBJ(callee), arg_len);
 
       case OBJ_NATIVE_FN: {
-        NativeFn native = AS_NATIVE(callee);
-        Value result = native(arg_len, vm.stack_top - arg_len);
+        ObjNativeFn* native = AS_NATIVE(callee);
+
+        if (native->arity != -1 && arg_len != native->arity) {
+          runtime_error("Expected %d arguments, but got %d.", native->arity, arg_len);
+          return false;
+        }
+
+        Value result = NIL_VAL;
+
+        if (!native->function(arg_len, vm.stack_top - arg_len, &result)) {
+          return false;
+        }
+
         vm.stack_top -= arg_len + 1;
         push(result);
         return true;
@@ -146,11 +190,16 @@ static bool call_value(Value callee, int arg_len) {
 
       case OBJ_CLASS: {
         ObjClass* class = AS_CLASS(callee);
-        vm.stack_top[-arg_len - 1] = OBJ_VAL(instance_new(class));
+        ObjInstance* instance = instance_new(class);
+        vm.stack_top[-arg_len - 1] = OBJ_VAL(instance);
 
-        Value constructor;
-        if (table_get(&class->methods, vm.init_string, &constructor)) {
-          return call(AS_CLOSURE(constructor), arg_len);
+        if (class->field_len > 0) {
+          int len = class->field_len;
+          table_reserve(&instance->fields, len < CLASS_RESERVE_MAX ? len : CLASS_RESERVE_MAX);
+        }
+
+        if (class->initializer != NULL) {
+          return call(class->initializer, arg_len);
         } else if (arg_len != 0) {
           runtime_error("Expected no arguments for constructor but got %d.", arg_len);
           return false;
@@ -167,7 +216,7 @@ static bool call_value(Value callee, int arg_len) {
 
       default:
         runtime_error("Cannot call object of kind '%d'.", AS_OBJ(callee)->kind);
-        break;
+        return false;
     }
   }
 
@@ -175,67 +224,82 @@ static bool call_value(Value callee, int arg_len) {
   return false;
 }
 
-static ObjUpvalue* capture_upvalue(Value* local) {
-  ObjUpvalue* prev = NULL;
-  ObjUpvalue* upvalue = vm.open_upvalues;
-
-  while (upvalue != NULL && upvalue->ptr > local) {
-    prev = upvalue;
-    upvalue = upvalue->next;
-  }
+// Closures only ever capture locals of the frame that creates them.
+static ObjUpvalue* capture_upvalue(CallFrame* frame, int idx) {
+  Value* slot = frame->slots + idx;
+  ObjUpvalue** open = &vm.open_upvalues[slot - vm.stack];
 
-  if (upvalue != NULL && upvalue->ptr == local) {
-    return upvalue;
+  if (*open == NULL) {
+    *open = upvalue_new(slot);
+    frame->open_upvalue_len += 1;
   }
 
-  ObjUpvalue* created_upvalue = upvalue_new(local);
-  created_upvalue->next = upvalue;
-
-  if (prev == NULL) {
-    vm.open_upvalues = created_upvalue;
-  } else {
-    prev->next = created_upvalue;
-  }
-
-  return created_upvalue;
+  return *open;
 }
 
-static void close_upvalues(Value* last) {
-  while (vm.open_upvalues != NULL && vm.open_upvalues->ptr >= last) {
-    ObjUpvalue* upvalue = vm.open_upvalues;
+// Closes the open upvalues of the slots from `first` up to the stack top.
+static void close_upvalues(CallFrame* frame, Value* first) {
+  for (Value* slot = first; frame->open_upvalue_len > 0 && slot < vm.stack_top; slot++) {
+    ObjUpvalue** open = &vm.open_upvalues[slot - vm.stack];
 
-    upvalue->closed = *upvalue->ptr;
-    upvalue->ptr = &upvalue->closed;
-
-    vm.open_upvalues = upvalue->next;
+    if (*open != NULL) {
+      (*open)->closed = *slot;
+      (*open)->ptr = &(*open)->closed;
+      *open = NULL;
+      frame->open_upvalue_len -= 1;
+    }
   }
 }
 
-void define_native(const char* name, NativeFn function) {
+void define_native(const char* name, int arity, NativeFn function) {
   push(OBJ_VAL(string_copy(name, (int) strlen(name))));
-  push(OBJ_VAL(native_new(function)));
+  push(OBJ_VAL(native_new(function, arity)));
   table_set(&vm.globals, AS_STRING(vm.stack[0]), vm.stack[1]);
   pop();
   pop();
 }
 
-static void define_method(ObjString* name) {
+// The compiler only emits OP_METHOD with a class and method on the stack, but code loaded from an
+// image is checked here, as the verifier doesn't track kinds of values.
+static bool define_method(ObjString* name) {
   Value method = peek(0);
+
+  if (!IS_CLASS(peek(1)) || !(IS_CLOSURE(method) || IS_FUNCTION(method))) {
+    runtime_error("Methods can only be functions defined on classes.");
+    return false;
+  }
+
   ObjClass* class = AS_CLASS(peek(1));
 
   table_set(&class->methods, name, method);
+
+  if (name == vm.init_string) {
+    class->initializer = AS_OBJ(method);
+  }
+
   pop();
+  return true;
 }
 
 static bool bind_method(ObjClass* class, ObjString* name) {
   Value method;
 
   if (!table_get(&class->methods, name, &method)) {
-    runtime_error("Undefined property '%s'.", name->chars);
+    runtime_error("Undefined property '%s'.", string_chars(name));
     return false;
   }
 
-  ObjBoundMethod* bound = boundmethod_new(peek(0), AS_CLOSURE(method));
+  Value receiver = peek(0);
+  ObjInstance* instance = IS_INSTANCE(receiver) ? AS_INSTANCE(receiver) : NULL;
+  ObjBoundMethod* bound = instance != NULL ? instance->bound : NULL;
+
+  if (bound == NULL || bound->method != AS_OBJ(method)) {
+    bound = boundmethod_new(receiver, AS_OBJ(method));
+
+    if (instance != NULL) {
+      instance->bound = bound;
+    }
+  }
 
   pop();
   push(OBJ_VAL(bound));
@@ -246,11 +310,11 @@ static bool invoke_from_class(ObjClass* class, ObjString* name, int arg_len) {
   Value method;
 
   if (!table_get(&class->methods, name, &method)) {
-    runtime_error("Undefined property '%s'.", name->chars);
+    runtime_error("Undefined property '%s'.", string_chars(name));
     return false;
   }
 
-  return call(AS_CLOSURE(method), arg_len);
+  return call(AS_OBJ(method), arg_len);
 }
 
 static bool invoke(ObjString* name, uint8_t arg_len) {
@@ -272,24 +336,186 @@ static bool invoke(ObjString* name, uint8_t arg_len) {
   return invoke_from_class(instance->class, name, arg_len);
 }
 
-#define CHUNK() (&frame->closure->function->chunk)
+// Doubles with an integral value are accepted too.
+static bool check_index(Value index, int len, int* dest) {
+  int64_t idx;
+
+  if (IS_INT(index)) {
+    idx = AS_INT(index);
+  } else if (!IS_NUMBER(index) || !value_as_int(AS_NUMBER(index), &idx)) {
+    runtime_error("Index must be an integer.");
+    return false;
+  }
+
+  if (idx < 0 || idx >= len) {
+    runtime_error("Index %" PRId64 " out of range for length %d.", idx, len);
+    return false;
+  }
+
+  *dest = (int) idx;
+  return true;
+}
+
+// NaN never equals itself, so an entry stored under it could never be found again. Slices are
+// interned in place, so a map never pins a large parent string through one of its keys.
+static bool check_map_key(Value* key) {
+  if (IS_SLICE(*key)) {
+    *key = OBJ_VAL(string_copy(text_chars(*key), text_len(*key)));
+    return true;
+  }
+
+  if (IS_NIL(*key) || IS_BOOL(*key) || IS_INT(*key) || IS_STRING(*key) ||
+      (IS_NUMBER(*key) && !isnan(AS_NUMBER(*key)))) {
+    return true;
+  }
+
+  runtime_error("Map keys must be nil, booleans, numbers (not NaN) or strings.");
+  return false;
+}
+
+// `slots` holds the loop variable, then the counter, limit and step of a numeric for loop. The
+// bounds are checked once here and made all integers or all doubles. For integers the limit is
+// replaced by the number of iterations left after the first, so the counter never overflows.
+static bool for_prepare(Value* slots, bool* is_empty) {
+  if (!IS_NUMERIC(slots[1]) || !IS_NUMERIC(slots[2]) || !IS_NUMERIC(slots[3])) {
+    runtime_error("Range bounds and step must be numbers.");
+    return false;
+  }
+
+  if (IS_INT(slots[1]) && IS_INT(slots[2]) && IS_INT(slots[3])) {
+    uint64_t start = (uint64_t) AS_INT(slots[1]);
+    uint64_t limit = (uint64_t) AS_INT(slots[2]);
+    int64_t step = AS_INT(slots[3]);
+
+    if (step == 0) {
+      runtime_error("Range step can't be zero.");
+      return false;
+    }
+
+    *is_empty = step > 0 ? AS_INT(slots[1]) >= AS_INT(slots[2])
+                         : AS_INT(slots[1]) <= AS_INT(slots[2]);
+
+    if (!*is_empty) {
+      uint64_t left = step > 0 ? (limit - start - 1) / (uint64_t) step
+                               : (start - limit - 1) / (0 - (uint64_t) step);
+      slots[2] = INT_VAL((int64_t) left);
+    }
+  } else {
+    double start = AS_FLOAT(slots[1]);
+    double limit = AS_FLOAT(slots[2]);
+    double step = AS_FLOAT(slots[3]);
+
+    if (step == 0) {
+      runtime_error("Range step can't be zero.");
+      return false;
+    }
+
+    slots[1] = NUMBER_VAL(start);
+    slots[2] = NUMBER_VAL(limit);
+    slots[3] = NUMBER_VAL(step);
+    *is_empty = !(step > 0 ? start < limit : start > limit);
+  }
+
+  slots[0] = slots[1];
+  return true;
+}
+
+#define CHUNK() (&frame->function->chunk)
 #define READ_BYTE() (*frame->ip++)
 #define READ_SHORT() (frame->ip += 2, (uint16_t) ((frame->ip[-2] << 8) | frame->ip[-1]))
 #define READ_CONSTANT() (CHUNK()->consts.values[READ_BYTE()])
 #define READ_STRING() AS_STRING(READ_CONSTANT())
 
-#define BINARY_OP(result_type, label, op)             \
-  case label: {                                       \
-    if (!IS_NUMBER(peek(0)) || !IS_NUMBER(peek(1))) { \
-      runtime_error("Operands must be numbers.");     \
-      return INTERPRET_RUNTIME_ERROR;                 \
-    }                                                 \
-                                                      \
-    double b = AS_NUMBER(pop());                      \
-    double a = AS_NUMBER(pop());                      \
-                                                      \
-    push(result_type(a op b));                        \
-    break;                                            \
+// Two integers give an integer, wrapping on overflow; mixing in a double widens both operands.
+#define ARITH_OP(label, op)                                                    \
+  case label: {                                                                \
+    Value b = pop();                                                           \
+    Value a = pop();                                                           \
+                                                                               \
+    if (IS_INT(a) && IS_INT(b)) {                                              \
+      push(INT_VAL((int64_t) ((uint64_t) AS_INT(a) op (uint64_t) AS_INT(b)))); \
+    } else if (IS_NUMERIC(a) && IS_NUMERIC(b)) {                               \
+      push(NUMBER_VAL(AS_FLOAT(a) op AS_FLOAT(b)));                            \
+    } else {                                                                   \
+      runtime_error("Operands must be numbers.");                              \
+      return INTERPRET_RUNTIME_ERROR;                                          \
+    }                                                                          \
+    break;                                                                     \
+  }
+
+#define COMPARE_OP(label, op)                     \
+  case label: {                                   \
+    Value b = pop();                              \
+    Value a = pop();                              \
+                                                  \
+    if (IS_INT(a) && IS_INT(b)) {                 \
+      push(BOOL_VAL(AS_INT(a) op AS_INT(b)));     \
+    } else if (IS_NUMERIC(a) && IS_NUMERIC(b)) {  \
+      push(BOOL_VAL(AS_FLOAT(a) op AS_FLOAT(b))); \
+    } else {                                      \
+      runtime_error("Operands must be numbers."); \
+      return INTERPRET_RUNTIME_ERROR;             \
+    }                                             \
+    break;                                        \
+  }
+
+#define COMPARE_JUMP_OP(label, op)                \
+  case label: {                                   \
+    uint16_t offset = READ_SHORT();               \
+    Value b = pop();                              \
+    Value a = pop();                              \
+    bool holds;                                   \
+                                                  \
+    if (IS_INT(a) && IS_INT(b)) {                 \
+      holds = AS_INT(a) op AS_INT(b);             \
+    } else if (IS_NUMERIC(a) && IS_NUMERIC(b)) {  \
+      holds = AS_FLOAT(a) op AS_FLOAT(b);         \
+    } else {                                      \
+      runtime_error("Operands must be numbers."); \
+      return INTERPRET_RUNTIME_ERROR;             \
+    }                                             \
+                                                  \
+    if (!holds) {                                 \
+      frame->ip += offset;                        \
+    }                                             \
+    break;                                        \
+  }
+
+// The operands of these are known to be of the right kind. `a` and `b` are the values inside
+// `expr`.
+#define TYPED_OP(label, make, expr) \
+  case label: {                     \
+    Value b = pop();                \
+    Value a = pop();                \
+    push(make(expr));               \
+    break;                          \
+  }
+
+#define TYPED_JUMP_OP(label, expr)  \
+  case label: {                     \
+    uint16_t offset = READ_SHORT(); \
+    Value b = pop();                \
+    Value a = pop();                \
+                                    \
+    if (!(expr)) {                  \
+      frame->ip += offset;          \
+    }                               \
+    break;                          \
+  }
+
+// `a` and `b` are the int64_t operands inside `expr`.
+#define BITWISE_OP(label, expr)                    \
+  case label: {                                    \
+    if (!IS_INT(peek(0)) || !IS_INT(peek(1))) {    \
+      runtime_error("Operands must be integers."); \
+      return INTERPRET_RUNTIME_ERROR;              \
+    }                                              \
+                                                   \
+    int64_t b = AS_INT(pop());                     \
+    int64_t a = AS_INT(pop());                     \
+                                                   \
+    push(INT_VAL(expr));                           \
+    break;                                         \
   }
 
 static InterpretResult run(void) {
@@ -314,18 +540,92 @@ static InterpretResult run(void) {
 #pragma clang diagnostic push
 #pragma clang diagnostic warning "-Wswitch-enum"
     switch ((OpCode) instr) {
-      BINARY_OP(NUMBER_VAL, OP_SUBTRACT, -);
-      BINARY_OP(NUMBER_VAL, OP_MULTIPLY, *);
-      BINARY_OP(NUMBER_VAL, OP_DIVIDE, /);
+      ARITH_OP(OP_SUBTRACT, -);
+      ARITH_OP(OP_MULTIPLY, *);
+
+      COMPARE_OP(OP_LESSER, <);
+      COMPARE_OP(OP_GREATER, >);
+      COMPARE_OP(OP_LESSER_EQUAL, <=);
+      COMPARE_OP(OP_GREATER_EQUAL, >=);
+
+      TYPED_OP(OP_ADD_INT, INT_VAL, (int64_t) ((uint64_t) AS_INT(a) + (uint64_t) AS_INT(b)));
+      TYPED_OP(OP_SUBTRACT_INT, INT_VAL, (int64_t) ((uint64_t) AS_INT(a) - (uint64_t) AS_INT(b)));
+      TYPED_OP(OP_MULTIPLY_INT, INT_VAL, (int64_t) ((uint64_t) AS_INT(a) * (uint64_t) AS_INT(b)));
+      TYPED_OP(OP_LESSER_INT, BOOL_VAL, AS_INT(a) < AS_INT(b));
+      TYPED_OP(OP_GREATER_INT, BOOL_VAL, AS_INT(a) > AS_INT(b));
+      TYPED_OP(OP_LESSER_EQUAL_INT, BOOL_VAL, AS_INT(a) <= AS_INT(b));
+      TYPED_OP(OP_GREATER_EQUAL_INT, BOOL_VAL, AS_INT(a) >= AS_INT(b));
+      TYPED_JUMP_OP(OP_JUMP_UNLESS_LESSER_INT, AS_INT(a) < AS_INT(b));
+      TYPED_JUMP_OP(OP_JUMP_UNLESS_GREATER_INT, AS_INT(a) > AS_INT(b));
+      TYPED_JUMP_OP(OP_JUMP_UNLESS_LESSER_EQUAL_INT, AS_INT(a) <= AS_INT(b));
+      TYPED_JUMP_OP(OP_JUMP_UNLESS_GREATER_EQUAL_INT, AS_INT(a) >= AS_INT(b));
+
+      TYPED_OP(OP_ADD_NUM, NUMBER_VAL, AS_NUMBER(a) + AS_NUMBER(b));
+      TYPED_OP(OP_SUBTRACT_NUM, NUMBER_VAL, AS_NUMBER(a) - AS_NUMBER(b));
+      TYPED_OP(OP_MULTIPLY_NUM, NUMBER_VAL, AS_NUMBER(a) * AS_NUMBER(b));
+      TYPED_OP(OP_LESSER_NUM, BOOL_VAL, AS_NUMBER(a) < AS_NUMBER(b));
+      TYPED_OP(OP_GREATER_NUM, BOOL_VAL, AS_NUMBER(a) > AS_NUMBER(b));
+      TYPED_OP(OP_LESSER_EQUAL_NUM, BOOL_VAL, AS_NUMBER(a) <= AS_NUMBER(b));
+      TYPED_OP(OP_GREATER_EQUAL_NUM, BOOL_VAL, AS_NUMBER(a) >= AS_NUMBER(b));
+      TYPED_JUMP_OP(OP_JUMP_UNLESS_LESSER_NUM, AS_NUMBER(a) < AS_NUMBER(b));
+      TYPED_JUMP_OP(OP_JUMP_UNLESS_GREATER_NUM, AS_NUMBER(a) > AS_NUMBER(b));
+      TYPED_JUMP_OP(OP_JUMP_UNLESS_LESSER_EQUAL_NUM, AS_NUMBER(a) <= AS_NUMBER(b));
+      TYPED_JUMP_OP(OP_JUMP_UNLESS_GREATER_EQUAL_NUM, AS_NUMBER(a) >= AS_NUMBER(b));
+
+      BITWISE_OP(OP_BIT_AND, a & b);
+      BITWISE_OP(OP_BIT_OR, a | b);
+      BITWISE_OP(OP_BIT_XOR, a ^ b);
+      BITWISE_OP(OP_SHIFT_LEFT, (int64_t) ((uint64_t) a << (b & 63)));
+      BITWISE_OP(OP_SHIFT_RIGHT, a >> (b & 63));
+
+      // Division always produces a double, even for two integers.
+      case OP_DIVIDE: {
+        if (!IS_NUMERIC(peek(0)) || !IS_NUMERIC(peek(1))) {
+          runtime_error("Operands must be numbers.");
+          return INTERPRET_RUNTIME_ERROR;
+        }
+
+        Value b = pop();
+        Value a = pop();
+
+        push(NUMBER_VAL(AS_FLOAT(a) / AS_FLOAT(b)));
+        break;
+      }
+
+      // The result takes the sign of the dividend, as in C.
+      case OP_MODULO: {
+        Value b = pop();
+        Value a = pop();
+
+        if (IS_INT(a) && IS_INT(b)) {
+          if (AS_INT(b) == 0) {
+            runtime_error("Integer modulo by zero.");
+            return INTERPRET_RUNTIME_ERROR;
+          }
 
-      BINARY_OP(BOOL_VAL, OP_LESSER, <);
-      BINARY_OP(BOOL_VAL, OP_GREATER, >);
-      BINARY_OP(BOOL_VAL, OP_LESSER_EQUAL, <=);
-      BINARY_OP(BOOL_VAL, OP_GREATER_EQUAL, >=);
+          // INT64_MIN % -1 overflows in C, though the result is always 0.
+          push(INT_VAL(AS_INT(b) == -1 ? 0 : AS_INT(a) % AS_INT(b)));
+        } else if (IS_NUMERIC(a) && IS_NUMERIC(b)) {
+          push(NUMBER_VAL(fmod(AS_FLOAT(a), AS_FLOAT(b))));
+        } else {
+          runtime_error("Operands must be numbers.");
+          return INTERPRET_RUNTIME_ERROR;
+        }
+        break;
+      }
+
+      case OP_BIT_NOT:
+        if (!IS_INT(peek(0))) {
+          runtime_error("Operand must be an integer.");
+          return INTERPRET_RUNTIME_ERROR;
+        }
+
+        push(INT_VAL(~AS_INT(pop())));
+        break;
 
       case OP_RETURN: {
         Value result = pop();
-        close_upvalues(frame->slots);
+        close_upvalues(frame, frame->slots);
         vm.frames_len--;
 
         if (vm.frames_len == 0) {
@@ -344,33 +644,33 @@ static InterpretResult run(void) {
         break;
 
       case OP_NEGATE:
-        if (!IS_NUMBER(peek(0))) {
+        if (IS_INT(peek(0))) {
+          push(INT_VAL((int64_t) (0 - (uint64_t) AS_INT(pop()))));
+        } else if (IS_NUMBER(peek(0))) {
+          push(NUMBER_VAL(-AS_NUMBER(pop())));
+        } else {
           runtime_error("Operand must be a number.");
           return INTERPRET_RUNTIME_ERROR;
         }
-
-        push(NUMBER_VAL(-AS_NUMBER(pop())));
         break;
 
       case OP_ADD:
-        if (IS_STRING(peek(0)) && IS_STRING(peek(1))) {
-          ObjString* b = AS_STRING(peek(0));
-          ObjString* a = AS_STRING(peek(1));
+        if (IS_TEXT(peek(0)) && IS_TEXT(peek(1))) {
+          Value b = peek(0);
+          Value a = peek(1);
+          ObjString* result = string_concat(text_chars(a), text_len(a), text_chars(b), text_len(b));
 
-          int len = a->len + b->len;
-          char* chars = MEM_ALLOC(char, len + 1);
-          memcpy(chars, a->chars, a->len);
-          memcpy(chars + a->len, b->chars, b->len);
-          chars[len] = '\0';
-
-          ObjString* result = string_new(chars, len);
           pop();
           pop();
           push(OBJ_VAL(result));
-        } else if (IS_NUMBER(peek(0)) && IS_NUMBER(peek(1))) {
-          double b = AS_NUMBER(pop());
-          double a = AS_NUMBER(pop());
-          push(NUMBER_VAL(a + b));
+        } else if (IS_INT(peek(0)) && IS_INT(peek(1))) {
+          uint64_t b = (uint64_t) AS_INT(pop());
+          uint64_t a = (uint64_t) AS_INT(pop());
+          push(INT_VAL((int64_t) (a + b)));
+        } else if (IS_NUMERIC(peek(0)) && IS_NUMERIC(peek(1))) {
+          Value b = pop();
+          Value a = pop();
+          push(NUMBER_VAL(AS_FLOAT(a) + AS_FLOAT(b)));
         } else {
           runtime_error("Operands must be two strings or two numbers.");
           return INTERPRET_RUNTIME_ERROR;
@@ -416,6 +716,10 @@ static InterpretResult run(void) {
         pop();
         break;
 
+      case OP_DUP:
+        push(peek(0));
+        break;
+
       case OP_DEFINE_GLOBAL: {
         ObjString* name = READ_STRING();
         table_set(&vm.globals, name, peek(0));
@@ -428,7 +732,7 @@ static InterpretResult run(void) {
         Value value;
 
         if (!table_get(&vm.globals, name, &value)) {
-          runtime_error("Undefined variable '%s'.", name->chars);
+          runtime_error("Undefined variable '%s'.", string_chars(name));
           return INTERPRET_RUNTIME_ERROR;
         }
 
@@ -441,7 +745,7 @@ static InterpretResult run(void) {
 
         if (table_set(&vm.globals, name, peek(0))) {
           table_remove(&vm.globals, name);
-          runtime_error("Undefined variable '%s'.", name->chars);
+          runtime_error("Undefined variable '%s'.", string_chars(name));
           return INTERPRET_RUNTIME_ERROR;
         }
 
@@ -456,6 +760,21 @@ static InterpretResult run(void) {
         frame->slots[READ_BYTE()] = peek(0);
         break;
 
+      case OP_INC_LOCAL: {
+        Value* slot = &frame->slots[READ_BYTE()];
+        int8_t step = (int8_t) READ_BYTE();
+
+        if (IS_INT(*slot)) {
+          *slot = INT_VAL((int64_t) ((uint64_t) AS_INT(*slot) + (uint64_t) step));
+        } else if (IS_NUMBER(*slot)) {
+          *slot = NUMBER_VAL(AS_NUMBER(*slot) + step);
+        } else {
+          runtime_error("Operand must be a number.");
+          return INTERPRET_RUNTIME_ERROR;
+        }
+        break;
+      }
+
       case OP_JUMP: {
         uint16_t offset = READ_SHORT();
         frame->ip += offset;
@@ -468,18 +787,131 @@ static InterpretResult run(void) {
         break;
       }
 
-      case OP_JUMP_IF_TRUE: {
+      case OP_JUMP_IF_TRUE_OR_POP: {
         uint16_t offset = READ_SHORT();
         if (!value_is_falsey(peek(0))) {
           frame->ip += offset;
+        } else {
+          pop();
         }
         break;
       }
 
-      case OP_JUMP_IF_FALSE: {
+      case OP_JUMP_IF_FALSE_OR_POP: {
         uint16_t offset = READ_SHORT();
         if (value_is_falsey(peek(0))) {
           frame->ip += offset;
+        } else {
+          pop();
+        }
+        break;
+      }
+
+      case OP_POP_JUMP_IF_FALSE: {
+        uint16_t offset = READ_SHORT();
+        if (value_is_falsey(pop())) {
+          frame->ip += offset;
+        }
+        break;
+      }
+
+      COMPARE_JUMP_OP(OP_JUMP_UNLESS_LESSER, <);
+      COMPARE_JUMP_OP(OP_JUMP_UNLESS_GREATER, >);
+      COMPARE_JUMP_OP(OP_JUMP_UNLESS_LESSER_EQUAL, <=);
+      COMPARE_JUMP_OP(OP_JUMP_UNLESS_GREATER_EQUAL, >=);
+
+      case OP_JUMP_UNLESS_EQUAL: {
+        uint16_t offset = READ_SHORT();
+        Value b = pop();
+        Value a = pop();
+        if (!value_is_equal(a, b)) {
+          frame->ip += offset;
+        }
+        break;
+      }
+
+      case OP_JUMP_UNLESS_NOT_EQUAL: {
+        uint16_t offset = READ_SHORT();
+        Value b = pop();
+        Value a = pop();
+        if (value_is_equal(a, b)) {
+          frame->ip += offset;
+        }
+        break;
+      }
+
+      case OP_JUMP_UNLESS_CALLEE: {
+        Value callee = READ_CONSTANT();
+        Value actual = peek(READ_BYTE());
+        uint16_t offset = READ_SHORT();
+
+        if (!IS_OBJ(actual) || AS_OBJ(actual) != AS_OBJ(callee)) {
+          frame->ip += offset;
+        }
+        break;
+      }
+
+      case OP_CHECK_INT:
+        if (!IS_INT(frame->slots[READ_BYTE()])) {
+          runtime_error("Argument must be an integer.");
+          return INTERPRET_RUNTIME_ERROR;
+        }
+        break;
+
+      case OP_CHECK_FLOAT: {
+        Value* slot = &frame->slots[READ_BYTE()];
+
+        if (!IS_NUMERIC(*slot)) {
+          runtime_error("Argument must be a number.");
+          return INTERPRET_RUNTIME_ERROR;
+        }
+
+        *slot = NUMBER_VAL(AS_FLOAT(*slot));
+        break;
+      }
+
+      case OP_FOR_PREP: {
+        Value* slots = &frame->slots[READ_BYTE()];
+        uint16_t offset = READ_SHORT();
+        bool is_empty;
+
+        if (!for_prepare(slots, &is_empty)) {
+          return INTERPRET_RUNTIME_ERROR;
+        }
+
+        if (is_empty) {
+          frame->ip += offset;
+        }
+        break;
+      }
+
+      case OP_FOR_LOOP: {
+        Value* slots = &frame->slots[READ_BYTE()];
+        uint16_t offset = READ_SHORT();
+
+        // OP_FOR_PREP leaves the counter, limit and step all integers or all doubles, but code
+        // from an image could skip it, and they are updated in place.
+        if (IS_INT(slots[1]) && IS_INT(slots[2]) && IS_INT(slots[3])) {
+          if (AS_INT(slots[2]) != 0) {
+            uint64_t counter = (uint64_t) AS_INT(slots[1]) + (uint64_t) AS_INT(slots[3]);
+
+            AS_INT(slots[2]) = (int64_t) ((uint64_t) AS_INT(slots[2]) - 1);
+            AS_INT(slots[1]) = (int64_t) counter;
+            slots[0] = slots[1];
+            frame->ip -= offset;
+          }
+        } else if (IS_NUMBER(slots[1]) && IS_NUMBER(slots[2]) && IS_NUMBER(slots[3])) {
+          double counter = AS_NUMBER(slots[1]) + AS_NUMBER(slots[3]);
+
+          if (AS_NUMBER(slots[3]) > 0 ? counter < AS_NUMBER(slots[2])
+                                      : counter > AS_NUMBER(slots[2])) {
+            AS_NUMBER(slots[1]) = counter;
+            slots[0] = slots[1];
+            frame->ip -= offset;
+          }
+        } else {
+          runtime_error("Range bounds and step must be numbers.");
+          return INTERPRET_RUNTIME_ERROR;
         }
         break;
       }
@@ -495,15 +927,25 @@ static InterpretResult run(void) {
 
       case OP_CLOSURE: {
         ObjFunction* function = AS_FUNCTION(READ_CONSTANT());
-        ObjClosure* closure = closure_new(function);
+        int stack_len = 0;
+
+        for (int i = 0; i < function->upvalue_len; i++) {
+          stack_len += frame->ip[2 * i] == CAPTURE_STACK;
+        }
+
+        ObjClosure* closure = closure_new(function, stack_len);
+        ObjUpvalue* stack_upvalue = CLOSURE_STACK_UPVALUES(closure);
         push(OBJ_VAL(closure));
 
         for (int i = 0; i < closure->upvalue_len; i++) {
-          uint8_t is_local = READ_BYTE();
+          uint8_t kind = READ_BYTE();
           uint8_t idx = READ_BYTE();
 
-          if (is_local) {
-            closure->upvalues[i] = capture_upvalue(frame->slots + idx);
+          if (kind == CAPTURE_STACK) {
+            stack_upvalue->ptr = frame->slots + idx;
+            closure->upvalues[i] = stack_upvalue++;
+          } else if (kind == CAPTURE_LOCAL) {
+            closure->upvalues[i] = capture_upvalue(frame, idx);
           } else {
             closure->upvalues[i] = frame->closure->upvalues[idx];
           }
@@ -524,7 +966,7 @@ static InterpretResult run(void) {
       }
 
       case OP_CLOSE_UPVALUE:
-        close_upvalues(vm.stack_top - 1);
+        close_upvalues(frame, vm.stack_top - 1);
         pop();
         break;
 
@@ -559,7 +1001,11 @@ static InterpretResult run(void) {
         }
 
         ObjInstance* instance = AS_INSTANCE(peek(1));
-        table_set(&instance->fields, READ_STRING(), peek(0));
+
+        if (table_set(&instance->fields, READ_STRING(), peek(0)) &&
+            instance->fields.len > instance->class->field_len) {
+          instance->class->field_len = instance->fields.len;
+        }
 
         Value value = pop();
         pop();
@@ -568,7 +1014,9 @@ static InterpretResult run(void) {
       }
 
       case OP_METHOD:
-        define_method(READ_STRING());
+        if (!define_method(READ_STRING())) {
+          return INTERPRET_RUNTIME_ERROR;
+        }
         break;
 
       case OP_INVOKE: {
@@ -584,20 +1032,28 @@ static InterpretResult run(void) {
       }
 
       case OP_INHERIT: {
-        if (!IS_CLASS(peek(0))) {
+        if (!IS_CLASS(peek(1)) || !IS_CLASS(peek(0))) {
           runtime_error("Superclass must be a class.");
           return INTERPRET_RUNTIME_ERROR;
         }
 
-        ObjClass* superclass = AS_CLASS(peek(0));
-        ObjClass* subclass = AS_CLASS(peek(1));
+        ObjClass* superclass = AS_CLASS(peek(1));
+        ObjClass* subclass = AS_CLASS(peek(0));
         table_add_all(&superclass->methods, &subclass->methods);
+        subclass->initializer = superclass->initializer;
+        subclass->field_len = superclass->field_len;
         pop();
         break;
       }
 
       case OP_GET_SUPER: {
         ObjString* name = READ_STRING();
+
+        if (!IS_CLASS(peek(0))) {
+          runtime_error("Superclass must be a class.");
+          return INTERPRET_RUNTIME_ERROR;
+        }
+
         ObjClass* superclass = AS_CLASS(pop());
 
         if (!bind_method(superclass, name)) {
@@ -610,6 +1066,12 @@ static InterpretResult run(void) {
       case OP_SUPER_INVOKE: {
         ObjString* method = READ_STRING();
         int arg_len = READ_BYTE();
+
+        if (!IS_CLASS(peek(0))) {
+          runtime_error("Superclass must be a class.");
+          return INTERPRET_RUNTIME_ERROR;
+        }
+
         ObjClass* superclass = AS_CLASS(pop());
 
         if (!invoke_from_class(superclass, method, arg_len)) {
@@ -620,6 +1082,121 @@ static InterpretResult run(void) {
         break;
       }
 
+      case OP_LIST: {
+        int len = READ_BYTE();
+        ObjList* list = list_new();
+
+        push(OBJ_VAL(list));
+
+        for (int i = len; i > 0; i--) {
+          valuelist_write(&list->items, peek(i));
+        }
+
+        vm.stack_top -= len + 1;
+        push(OBJ_VAL(list));
+        break;
+      }
+
+      case OP_MAP: {
+        int len = READ_BYTE();
+        ObjMap* map = map_new();
+
+        push(OBJ_VAL(map));
+
+        for (int i = 2 * len; i > 0; i -= 2) {
+          if (!check_map_key(&vm.stack_top[-1 - i])) {
+            return INTERPRET_RUNTIME_ERROR;
+          }
+
+          map_set(&map->map, peek(i), peek(i - 1));
+        }
+
+        vm.stack_top -= 2 * len + 1;
+        push(OBJ_VAL(map));
+        break;
+      }
+
+      case OP_INDEX_GET: {
+        Value target = peek(1);
+        int idx;
+
+        if (IS_LIST(target)) {
+          ObjList* list = AS_LIST(target);
+
+          if (!check_index(peek(0), list->items.len, &idx)) {
+            return INTERPRET_RUNTIME_ERROR;
+          }
+
+          vm.stack_top -= 2;
+          push(list->items.values[idx]);
+        } else if (IS_FLOAT64_ARRAY(target)) {
+          ObjFloat64Array* array = AS_FLOAT64_ARRAY(target);
+
+          if (!check_index(peek(0), array->len, &idx)) {
+            return INTERPRET_RUNTIME_ERROR;
+          }
+
+          vm.stack_top -= 2;
+          push(NUMBER_VAL(array->values[idx]));
+        } else if (IS_MAP(target)) {
+          Value value;
+
+          if (!map_get(&AS_MAP(target)->map, peek(0), &value)) {
+            value = NIL_VAL;
+          }
+
+          vm.stack_top -= 2;
+          push(value);
+        } else {
+          runtime_error("Only lists, arrays and maps can be indexed.");
+          return INTERPRET_RUNTIME_ERROR;
+        }
+
+        break;
+      }
+
+      case OP_INDEX_SET: {
+        Value target = peek(2);
+        Value value = peek(0);
+        int idx;
+
+        if (IS_LIST(target)) {
+          ObjList* list = AS_LIST(target);
+
+          if (!check_index(peek(1), list->items.len, &idx)) {
+            return INTERPRET_RUNTIME_ERROR;
+          }
+
+          list->items.values[idx] = value;
+        } else if (IS_FLOAT64_ARRAY(target)) {
+          ObjFloat64Array* array = AS_FLOAT64_ARRAY(target);
+
+          if (!check_index(peek(1), array->len, &idx)) {
+            return INTERPRET_RUNTIME_ERROR;
+          }
+
+          if (!IS_NUMERIC(value)) {
+            runtime_error("Float64 array elements must be numbers.");
+            return INTERPRET_RUNTIME_ERROR;
+          }
+
+          array->values[idx] = AS_FLOAT(value);
+        } else if (IS_MAP(target)) {
+          if (!check_map_key(&vm.stack_top[-2])) {
+            return INTERPRET_RUNTIME_ERROR;
+          }
+
+          map_set(&AS_MAP(target)->map, peek(1), value);
+        } else {
+          runtime_error("Only lists, arrays and maps can be indexed.");
+          return INTERPRET_RUNTIME_ERROR;
+        }
+
+        vm.stack_top -= 3;
+        push(value);
+        break;
+      }
+
       default:
         printf("Unknown opcode: '%d'.\n", instr);
         return INTERPRET_RUNTIME_ERROR;
@@ -637,10 +1214,10 @@ InterpretResult vm_interpret(ObjFunction* function) {
 #endif
 
   push(OBJ_VAL(function));
-  ObjClosure* closure = closure_new(function);
-  pop();
-  push(OBJ_VAL(closure));
-  call(closure, 0);
+
+  if (!call((Obj*) function, 0)) {
+    return INTERPRET_RUNTIME_ERROR;
+  }
 
   return run();
 }